@@ -1,9 +1,16 @@
 #pragma once
 
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum ObjType {
   OBJ_CHAR,
   OBJ_DOT,
   OBJ_CLASS,
+  OBJ_UTF8_CLASS, // a set of code points, only made in RE_UTF8 mode.
 
   // entire regexes can be used as objects. think about this as:
   // (a+b*){2-3}
@@ -28,13 +35,36 @@ typedef struct Class {
   };
 } Class;
 
+// one way of spelling a code point from a set in utf-8: len bytes, where
+// byte j is somewhere between lo[j] and hi[j].
+typedef struct Utf8Seq {
+  int len;
+  unsigned char lo[4];
+  unsigned char hi[4];
+} Utf8Seq;
+
+// a set of code points, split into the byte sequences that spell them. this
+// is matched one byte at a time, without decoding the line.
+typedef struct Utf8Class {
+  Utf8Seq *seqs;
+  int num_seqs;
+  // the sequences that can start with the byte b are lead_index[2 * b] up to
+  // lead_index[2 * b + 1].
+  int *lead_index;
+} Utf8Class;
+
 typedef struct REComp REComp;
 
 typedef struct Obj {
   ObjType type;
   union {
     char ch;
+#ifdef __cplusplus
+    Class class_; // class is a keyword in c++.
+#else
     Class class;
+#endif
+    Utf8Class utf8;
     REComp *sub_regex;
   } data;
 } Obj;
@@ -73,6 +103,59 @@ typedef struct Pair {
 
 #define MAX_PAIRS 128
 
+// a 256-bit membership set over byte values. every object the parser produces
+// gets lowered into one of these, so the engines never have to look at the Obj
+// union on the hot path.
+typedef struct ByteSet {
+  uint64_t bits[4];
+} ByteSet;
+
+#define BYTESET_HAS(set, byte)                                                 \
+  (((set)->bits[(unsigned char)(byte) >> 6] >> ((byte) & 63)) & 1)
+
+// a Pair lowered into the form the engines run: the object as a ByteSet, and
+// the modifier as an inclusive repetition range. max is -1 when unbounded.
+// every repetition is greedy and never gives anything back, exactly like
+// _pair.
+typedef struct Step {
+  ByteSet set;
+  int min;
+  int max;
+} Step;
+
+// the strategy re_compile picked to run the pattern.
+typedef enum REPlan {
+  PLAN_INTERP,    // walk the pairs from every start, the original matcher.
+  PLAN_LITERAL,   // the pattern is a plain string, so just memmem for it.
+  PLAN_SHIFT_AND, // fixed-width pattern, bit-parallel shift-and in one word.
+  PLAN_PIKEVM,    // run every start at once as a list of threads.
+  PLAN_ONEPASS,   // anchored, so a single walk through the transition table.
+
+  PLAN_COUNT,
+} REPlan;
+
+// how the engine skips ahead to the next position that could start a match.
+typedef enum REPrefilter {
+  PREFILTER_NONE,
+  PREFILTER_MEMCHR,  // the first step requires one specific byte.
+  PREFILTER_BYTESET, // the first step requires a byte from a small set.
+
+  PREFILTER_COUNT,
+} REPrefilter;
+
+// the thread states of a pattern are (step, count) pairs, numbered in order.
+// a pattern with more of these than this just gets interpreted.
+#define MAX_STATES 1024
+
+// patterns with at most this many states also get a full transition table.
+#define DFA_MAX_STATES 256
+
+// what a transition table entry holds when the thread leaves the pattern.
+#define DFA_DONE 0xffff // the match ended right before this byte.
+#define DFA_DEAD 0xfffe // this start can't match.
+// the byte leads a multibyte code point, so the whole code point decides.
+#define DFA_LOOKAHEAD 0xfffd
+
 // representing a fully compiled regex pattern that can be directly run through
 // text.
 typedef struct REComp {
@@ -80,6 +163,39 @@ typedef struct REComp {
   int num_pairs;
   int has_caret;  // ^ at the beginning of the pattern.
   int has_dollar; // $ at the end of the pattern.
+  int flags;      // the REFlags it was compiled with.
+
+  // everything below is filled in by the planner at the end of re_compile.
+  Step steps[MAX_PAIRS];
+  REPlan plan;
+  REPrefilter prefilter;
+  unsigned char first_byte; // the byte PREFILTER_MEMCHR looks for.
+
+  // PLAN_LITERAL. a utf-8 character can take up to 4 bytes.
+  char literal[4 * MAX_PAIRS];
+  int literal_len;
+
+  // PLAN_SHIFT_AND. bit j of shift_masks[b] is set when the byte b can sit at
+  // offset j of a match.
+  uint64_t shift_masks[256];
+  int shift_len;
+
+  // PLAN_PIKEVM. the state of a thread sitting in step i with k repetitions
+  // eaten is step_base[i] + k. when a step can eat multibyte code points, a
+  // thread that took the lead byte of one still has to pass over the rest:
+  // state step_base[num_pairs] + 3 * t + j - 1 is on its way to state t with
+  // j bytes left.
+  int n_states;
+  int step_base[MAX_PAIRS + 1];
+  int has_multibyte;
+  unsigned char state_step[MAX_STATES];
+
+  // PLAN_ONEPASS and PLAN_PIKEVM. bytes that every step treats the same share
+  // a class, and dfa[state * n_classes + class] is the state a thread moves to
+  // on a byte of that class. NULL when the pattern has too many states.
+  unsigned char byte_class[256];
+  int n_classes;
+  uint16_t *dfa;
 } REComp;
 
 typedef struct Match {
@@ -90,8 +206,193 @@ typedef struct Match {
 
 // return the number of matches found. the *dest array will be filled with
 // descriptions of the matches.
-int re_get_matches(const char *line, REComp *compiled, Match *dest);
+int re_get_matches(const char *line, const REComp *compiled, Match *dest);
+
+// the mutable state the engines need while they match. a REComp is never
+// written to after re_compile, so one can be shared by any number of threads
+// without locking, as long as each thread brings its own scratch. a scratch
+// only allocates when a longer line or a bigger pattern comes along, so
+// reusing one across calls keeps matching allocation free.
+typedef struct REScratch REScratch;
+
+REScratch *re_scratch_alloc(const REComp *compiled);
+void re_scratch_free(REScratch *scratch);
+
+// re_get_matches, with the line length up front and the caller's scratch. the
+// line doesn't need to be NULL terminated. dest needs room for line_len
+// matches at worst.
+int re_get_matches_scratch(const char *line, int line_len,
+                           const REComp *compiled, REScratch *scratch,
+                           Match *dest);
+
+// whether the line has a match at all. cheaper than re_get_matches_scratch,
+// since the engines stop at the first match they come across. returns 1 or
+// 0, or RE_BUDGET_EXCEEDED.
+int re_is_match(const char *line, int line_len, const REComp *compiled,
+                REScratch *scratch);
+
+// a match found by re_scan_lines.
+typedef struct LineMatch {
+  long line_no;     // counting from 1.
+  long line_offset; // where the line starts in the buffer.
+  int line_len;     // not counting the newline.
+  Match match;      // relative to the start of the line.
+} LineMatch;
+
+// called for every match re_scan_lines finds. return nonzero to stop the scan.
+typedef int (*re_line_fn)(const LineMatch *lm, void *ctx);
+
+// options for re_scan_lines.
+typedef enum REScanFlags {
+  // only report one match per matching line, for callers that only care which
+  // lines match. the engines can stop at the first match they find.
+  RE_SCAN_ONE_PER_LINE = 1 << 0,
+} REScanFlags;
+
+// run the pattern over every line of buf, with ^ and $ anchored to the ends of
+// each line, and call callback for each match. lines are only found around
+// places that could start a match, so for a selective pattern most lines are
+// never looked at on their own. returns the number of matches reported, or
+// RE_BUDGET_EXCEEDED if the scratch's budget ran out over the whole scan.
+long re_scan_lines(const char *buf, long len, const REComp *compiled,
+                   REScratch *scratch, int flags, re_line_fn callback,
+                   void *ctx);
+
+// run the pattern over a column of strings stored arrow-style: row i is the
+// bytes of data from offsets[i] up to offsets[i + 1], so offsets has n_rows + 1
+// entries. bit i % 64 of out_bitmap[i / 64] gets set when row i has a match,
+// and cleared otherwise. the rows share the caller's scratch, and its budget
+// covers the whole column. returns how many rows matched, or
+// RE_BUDGET_EXCEEDED, after which the bitmap is meaningless. patterns with a ^
+// run several rows through the one-pass table at a time.
+long re_match_batch(const char *data, const int32_t *offsets, long n_rows,
+                    const REComp *compiled, REScratch *scratch,
+                    uint64_t *out_bitmap);
+
+// what re_get_matches_scratch returns instead of a match count when it ran
+// out of budget. whatever was written to dest by then is meaningless.
+#define RE_BUDGET_EXCEEDED -1
+
+// what re_replace returns when the template refers to a pair the pattern
+// doesn't have.
+#define RE_BAD_TEMPLATE -2
+
+// called with each piece of re_replace_stream's output, in order.
+typedef void (*re_write_fn)(const char *data, long len, void *ctx);
+
+// replace the leftmost non-overlapping matches in input with replacement, where
+// $0 is the whole match, $1 to $N are what each pair ate, and $$ is a $. the
+// input is matched line by line with the caller's scratch, the same as
+// re_scan_lines, and the scratch's budget covers the whole input. writes as
+// much of the output as fits in out_cap bytes of out_buf, with no terminating
+// NUL, and returns the length of the whole output, or RE_BUDGET_EXCEEDED. pass
+// a NULL out_buf to just get the length, so the buffer can be allocated once.
+long re_replace(const char *input, long len, const REComp *compiled,
+                REScratch *scratch, const char *replacement, char *out_buf,
+                long out_cap);
+
+// re_replace, but the output goes to write as it's made instead of into a
+// buffer. since matches never cross lines, a big input can be fed through in
+// chunks that end on a newline. returns how many bytes were written.
+long re_replace_stream(const char *input, long len, const REComp *compiled,
+                       REScratch *scratch, const char *replacement,
+                       re_write_fn write, void *ctx);
+
+// cap the work of every re_get_matches_scratch call made with this scratch.
+// max_steps counts engine steps, which is roughly one byte looked at by one
+// thread. deadline_ns is a CLOCK_MONOTONIC time in nanoseconds, checked every
+// RE_BUDGET_INTERVAL steps. pass 0 for either one to leave it unlimited.
+#define RE_BUDGET_INTERVAL 4096
+void re_scratch_set_budget(REScratch *scratch, long max_steps,
+                           long long deadline_ns);
+
+// options for re_compile_flags.
+typedef enum REFlags {
+  // treat the pattern and the lines as utf-8. '.', classes and non-ascii
+  // characters match whole code points, and classes can hold non-ascii ranges
+  // like [α-ω] as well as \p{L}.
+  RE_UTF8 = 1 << 0,
+} REFlags;
+
+// a lexer rule: input that matches pattern becomes a token with this id.
+typedef struct LexRule {
+  const char *pattern;
+  int id;
+} LexRule;
+
+typedef struct Token {
+  int id;     // the rule's id, or RE_LEX_ERROR.
+  long start; // inclusive, like Match.
+  long end;
+} Token;
+
+// the id of the one byte token re_lex makes when no rule matches.
+#define RE_LEX_ERROR -1
+
+// a set of rules run together as one automaton. it's filled in as the input
+// needs it, so an RELexer can only be used by one thread at a time.
+typedef struct RELexer RELexer;
+
+// compile the rules, in order of priority. a ^ only matches at the start of
+// the input and a $ only at the end. returns NULL if a rule is too big.
+RELexer *re_lexer_compile(const LexRule *rules, int n_rules);
+
+// split input into tokens from byte from on, taking the longest match of any
+// rule at each position, and the earliest rule when two are just as long.
+// bytes no rule matches come out as RE_LEX_ERROR tokens. token positions are
+// offsets into input. returns how many tokens were written, which is
+// max_tokens if there might be more after the last one: to go on from there,
+// call it again with the same input and from at the last token's end + 1, so
+// a ^ still only matches at the real start.
+long re_lex(RELexer *lexer, const char *input, long len, long from,
+            Token *tokens, long max_tokens);
+void re_lexer_free(RELexer *lexer);
+
+// a document that keeps its matches up to date as it's edited. the text is
+// matched as a single line, the same as re_get_matches_scratch would, but an
+// edit only rescans from a little before it to where the matching stops
+// being any different.
+typedef struct REDoc REDoc;
+
+// what an edit changed. removed holds the old matches that went away, where
+// they were before the edit, and added the new ones, where they are after it.
+// matches that just moved along with the text aren't in either. both point
+// into the document, and are good until the next edit.
+typedef struct REDelta {
+  const Match *added;
+  long num_added;
+  const Match *removed;
+  long num_removed;
+} REDelta;
+
+// the document keeps its own copy of the text. compiled has to outlive it.
+REDoc *re_doc_new(const REComp *compiled, const char *text, long len);
+// replace the deleted bytes at offset with inserted, and fill in delta if it
+// isn't NULL.
+void re_doc_edit(REDoc *doc, long offset, long deleted, const char *inserted,
+                 long inserted_len, REDelta *delta);
+// every match in the document, in order of where they start.
+const Match *re_doc_matches(const REDoc *doc, long *num_matches);
+void re_doc_free(REDoc *doc);
 
 REComp *re_compile(const char *pattern_static);
+REComp *re_compile_flags(const char *pattern_static, int flags);
 void re_debug_print(REComp *recomp);
+
+// match the pattern once and fill spans[i] with the part of the line that
+// pair i ate, one span per pair. a pair that ate nothing gets an end one
+// before its start. returns whether there was a match. the fast path is a
+// pattern with a ^, which runs in a single pass with no backtracking.
+int re_extract(const char *line, const REComp *compiled, Match *spans);
+
+// which strategy the pattern runs with, for auditing slow patterns.
+REPlan re_get_plan(const REComp *compiled);
+REPrefilter re_get_prefilter(const REComp *compiled);
+const char *re_plan_name(REPlan plan);
+const char *re_prefilter_name(REPrefilter prefilter);
+
 void re_free(REComp *r);
+
+#ifdef __cplusplus
+}
+#endif
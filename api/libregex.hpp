@@ -0,0 +1,594 @@
+#pragma once
+
+// a c++ front end for patterns that are known at build time. the pattern is a
+// template argument, so it's parsed and lowered while the program compiles,
+// and each pattern gets its own matcher with its transition table as static
+// data. like the pikevm plan, every start runs at once in a single pass over
+// the line. nothing is compiled, allocated or freed at runtime:
+//
+//   using Date = re::Regex<"^[0-9]{4}-[0-9]{2}-[0-9]{2}$">;
+//   if (Date::is_match(line)) { ... }
+//
+// the syntax and the matches are exactly those of re_compile and
+// re_get_matches, quirks included. a pattern re_compile would overflow or read
+// past the end of, like an unterminated [ or (, is a compile error here.
+// RE_UTF8 isn't supported.
+
+#include "libregex.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace re {
+
+// a string literal as a template argument. like re_compile, the pattern stops
+// at the first NUL.
+template <std::size_t N> struct Pattern {
+  char chars[N] = {};
+
+  constexpr Pattern(const char (&s)[N]) {
+    for (std::size_t i = 0; i < N; i++) {
+      chars[i] = s[i];
+    }
+  }
+
+  constexpr int size() const {
+    int len = 0;
+    while (len < (int)N && chars[len] != '\0') {
+      len++;
+    }
+    return len;
+  }
+};
+
+// what re_compile would have filled in for the planner: just the steps, since
+// every engine runs off of those.
+struct Program {
+  Step steps[MAX_PAIRS] = {};
+  int num_pairs = 0;
+  int has_caret = 0;
+  int has_dollar = 0;
+  int n_states = 0;
+  int step_base[MAX_PAIRS + 1] = {};
+};
+
+constexpr void _byteset_add(ByteSet *set, unsigned char b) {
+  set->bits[b >> 6] |= (uint64_t)1 << (b & 63);
+}
+
+// the same parse as re_compile_flags, one character at a time, with each
+// object lowered straight into its ByteSet the way _lower_pair does it.
+template <std::size_t N> constexpr Program _compile(const Pattern<N> &pat) {
+  Program prog;
+  int len = pat.size();
+
+  // handle the opening and closing ^ and $.
+  prog.has_caret = (pat.chars[0] == '^');
+  prog.has_dollar = (len > 0 && pat.chars[len - 1] == '$');
+
+  int end = len; // where the pattern's NUL is, once the $ is taken off.
+  int offset = 0;
+  if (prog.has_dollar) {
+    end--;
+    len--;
+  }
+  if (prog.has_caret) {
+    offset = 1;
+    len--;
+  }
+
+  // reading past the end gives the NUL, like it does in the C parser.
+  auto at = [&](int idx) {
+    return (offset + idx < end) ? pat.chars[offset + idx] : '\0';
+  };
+
+  int idx = 0;
+  char pat_ch = at(idx);
+  auto next_char = [&]() {
+    idx++;
+    pat_ch = at(idx);
+  };
+
+  while (idx < len) {
+    if (prog.num_pairs == MAX_PAIRS) {
+      throw "too many pairs in the pattern.";
+    }
+    Step *step = &prog.steps[prog.num_pairs];
+
+    // first, parse the object at the cursor.
+    switch (pat_ch) {
+    case '\\': {
+      next_char();
+      if (pat_ch != '\0') {
+        _byteset_add(&step->set, pat_ch);
+      }
+      next_char();
+    } break;
+
+    case '.': {
+      for (int b = 1; b < 256; b++) {
+        if (b != '\n') {
+          _byteset_add(&step->set, b);
+        }
+      }
+      next_char();
+    } break;
+
+    case '(': {
+      // a subregex never matches anything, so all that's left is to skip it.
+      int so_len = 0;
+      next_char();
+      while (pat_ch != ']') {
+        if (pat_ch == '\0') {
+          throw "unterminated subregex.";
+        }
+        if (++so_len >= 128) {
+          throw "subregex is too long.";
+        }
+        next_char();
+      }
+      next_char();
+    } break;
+
+    case '[': {
+      char class_buf[32] = {};
+      int cb_len = 0;
+      next_char();
+      while (pat_ch != ']') {
+        if (pat_ch == '\0') {
+          throw "unterminated class.";
+        }
+        if (cb_len == 31) {
+          throw "class is too long.";
+        }
+        class_buf[cb_len++] = pat_ch;
+        next_char();
+      }
+      next_char();
+
+      const char *_class = class_buf;
+      int is_complement = 0;
+      if (_class[0] == '^') {
+        is_complement = 1;
+        _class++;
+      }
+
+      char ranges[64] = {};
+      int num_points = 0;
+      while (_class[0] != '\0') {
+        char start = _class[0];
+        char range_end = start;
+        if (_class[1] == '-' && _class[2] != '\0') {
+          range_end = _class[2];
+          _class += 3;
+        } else {
+          _class++;
+        }
+        ranges[num_points] = start;
+        ranges[num_points + 1] = range_end;
+        num_points += 2;
+      }
+
+      // the same signed comparison _obj_accepts makes.
+      for (int b = 1; b < 256; b++) {
+        char c = (char)b;
+        int in_class = 0;
+        for (int i = 0; i < num_points; i += 2) {
+          if (c >= ranges[i] && c < ranges[i + 1] + 1) {
+            in_class = 1;
+            break;
+          }
+        }
+        if (in_class != is_complement) {
+          _byteset_add(&step->set, b);
+        }
+      }
+    } break;
+
+    default: {
+      _byteset_add(&step->set, pat_ch);
+      next_char();
+    } break;
+    }
+
+    // then, parse the modifier at the cursor.
+    switch (pat_ch) {
+    case '*': {
+      step->min = 0;
+      step->max = -1;
+      next_char();
+    } break;
+    case '+': {
+      step->min = 1;
+      step->max = -1;
+      next_char();
+    } break;
+    case '?': {
+      step->min = 0;
+      step->max = 1;
+      next_char();
+    } break;
+
+    case '{': {
+      next_char();
+      int n_num = pat_ch - 48;
+      next_char();
+
+      if (pat_ch == ',') {
+        next_char();
+        if (pat_ch == '}') {
+          // {n,}
+          step->min = (n_num > 0) ? n_num : 0;
+          step->max = -1;
+        } else {
+          // {n,m}
+          int m_num = pat_ch - 48;
+          step->min = (n_num > 0) ? n_num : 0;
+          step->max = (m_num > 0) ? m_num : 0;
+          next_char();
+        }
+      } else {
+        // {n}
+        step->min = (n_num > 0) ? n_num : 0;
+        step->max = step->min;
+      }
+
+      next_char(); // skip past the last }
+    } break;
+
+    default: {
+      step->min = 1;
+      step->max = 1;
+    } break;
+    }
+
+    prog.step_base[prog.num_pairs] = prog.n_states;
+    prog.n_states += ((step->max < 0) ? step->min : step->max) + 1;
+    prog.num_pairs++;
+  }
+  prog.step_base[prog.num_pairs] = prog.n_states;
+
+  if (prog.n_states >= DFA_DEAD) {
+    throw "too many states in the pattern.";
+  }
+
+  return prog;
+}
+
+constexpr int _state_step(const Program &prog, int state) {
+  int i = 0;
+  while (prog.step_base[i + 1] <= state) {
+    i++;
+  }
+  return i;
+}
+
+// _state_next from plan.c.
+constexpr int _state_next(const Program &prog, int state, unsigned char b) {
+  int i = _state_step(prog, state);
+  int k = state - prog.step_base[i];
+
+  for (;;) {
+    const Step *step = &prog.steps[i];
+
+    if ((step->max < 0 || k < step->max) && BYTESET_HAS(&step->set, b)) {
+      if (step->max >= 0 || k < step->min) {
+        k++;
+      }
+      return prog.step_base[i] + k;
+    }
+
+    if (k < step->min) {
+      return DFA_DEAD;
+    }
+
+    i++;
+    k = 0;
+    if (i == prog.num_pairs) {
+      return DFA_DONE;
+    }
+  }
+}
+
+// bytes that every step treats the same share a class, same as _byte_classes.
+struct ByteClasses {
+  unsigned char byte_class[256] = {};
+  unsigned char rep[256] = {}; // one byte from each class.
+  int n_classes = 1;
+};
+
+constexpr ByteClasses _byte_classes(const Program &prog) {
+  ByteClasses bc;
+
+  for (int i = 0; i < prog.num_pairs; i++) {
+    int split[256][2] = {};
+    for (auto &slot : split) {
+      slot[0] = slot[1] = -1;
+    }
+    int n_classes = 0;
+
+    for (int b = 0; b < 256; b++) {
+      int in = BYTESET_HAS(&prog.steps[i].set, b);
+      int *slot = &split[bc.byte_class[b]][in];
+      if (*slot < 0) {
+        *slot = n_classes++;
+      }
+      bc.byte_class[b] = *slot;
+    }
+    bc.n_classes = n_classes;
+  }
+
+  for (int b = 255; b >= 0; b--) {
+    bc.rep[bc.byte_class[b]] = b;
+  }
+  return bc;
+}
+
+template <std::size_t SIZE>
+constexpr std::array<uint16_t, SIZE> _dfa_build(const Program &prog,
+                                                const ByteClasses &bc) {
+  std::array<uint16_t, SIZE> dfa = {};
+  for (int s = 0; s < prog.n_states; s++) {
+    for (int c = 0; c < bc.n_classes; c++) {
+      dfa[s * bc.n_classes + c] = _state_next(prog, s, bc.rep[c]);
+    }
+  }
+  return dfa;
+}
+
+// _state_accepts_at_end for every state.
+template <std::size_t SIZE>
+constexpr std::array<bool, SIZE> _accepts_at_end(const Program &prog) {
+  std::array<bool, SIZE> accepts = {};
+  for (int s = 0; s < prog.n_states; s++) {
+    int i = _state_step(prog, s);
+    accepts[s] = i == prog.num_pairs - 1 &&
+                 s - prog.step_base[i] >= prog.steps[i].min;
+  }
+  return accepts;
+}
+
+// the skip-ahead for starts, picked the same way _plan picks it.
+struct Prefilter {
+  REPrefilter kind = PREFILTER_NONE;
+  unsigned char first_byte = 0;
+};
+
+constexpr Prefilter _prefilter(const Program &prog) {
+  Prefilter pf;
+  if (prog.has_caret || prog.num_pairs == 0 || prog.steps[0].min == 0) {
+    return pf;
+  }
+
+  int count = 0;
+  for (int b = 0; b < 256; b++) {
+    if (BYTESET_HAS(&prog.steps[0].set, b)) {
+      pf.first_byte = (count == 0) ? b : pf.first_byte;
+      count++;
+    }
+  }
+  if (count == 1) {
+    pf.kind = PREFILTER_MEMCHR;
+  } else if (count <= 64) {
+    pf.kind = PREFILTER_BYTESET;
+  }
+  return pf;
+}
+
+template <Pattern P> struct Regex {
+  static constexpr Program prog = _compile(P);
+  static constexpr ByteClasses classes = _byte_classes(prog);
+  static constexpr int n_classes = classes.n_classes;
+  static constexpr int n_states = prog.n_states;
+  static constexpr Prefilter prefilter = _prefilter(prog);
+
+  static constexpr std::array<uint16_t, n_states * n_classes> dfa =
+      _dfa_build<n_states * n_classes>(prog, classes);
+  static constexpr std::array<bool, n_states> accepts_at_end =
+      _accepts_at_end<n_states>(prog);
+
+  // same as re_get_matches: dest needs room for a match per byte of line.
+  // it's also where the starts are kept while the line is being run.
+  static int get_matches(std::string_view line, Match *dest) {
+    return _run<false>(line, dest);
+  }
+
+  static bool is_match(std::string_view line) {
+    Match m;
+    return _run<true>(line, &m) > 0;
+  }
+
+private:
+  static constexpr int NO_MATCH = -2;
+
+  // the pikevm's thread groups, one per state, each a list of the starts in
+  // that state linked through dest[start].start.
+  struct Groups {
+    std::array<int, n_states> head;
+    std::array<int, n_states> tail;
+    std::array<int, n_states> live;
+    int num_live = 0;
+  };
+
+  // is_match only needs to know which states are live, so it doesn't keep
+  // the starts at all.
+  template <bool first_only>
+  static void _group_push(Groups *g, Match *dest, int state, int first,
+                          int last) {
+    if (g->head[state] < 0) {
+      g->head[state] = first;
+      g->live[g->num_live++] = state;
+    } else if constexpr (!first_only) {
+      dest[g->tail[state]].start = first;
+    }
+    g->tail[state] = last;
+  }
+
+  // the next place at or after p a match could start, or line_len.
+  static int _skip(const unsigned char *line, int line_len, int p) {
+    if constexpr (prefilter.kind == PREFILTER_MEMCHR) {
+      const void *hit =
+          std::memchr(line + p, prefilter.first_byte, line_len - p);
+      return hit ? (const unsigned char *)hit - line : line_len;
+    } else {
+      while (p < line_len && !BYTESET_HAS(&prog.steps[0].set, line[p])) {
+        p++;
+      }
+      return p;
+    }
+  }
+
+  // with a caret there's only the one thread, so it's the walk
+  // _onepass_matches does.
+  static int _onepass(const unsigned char *line, int line_len, Match *dest) {
+    if (line_len == 0) {
+      return 0;
+    }
+
+    int state = 0;
+    for (int p = 0; p < line_len; p++) {
+      uint16_t next = dfa[state * n_classes + classes.byte_class[line[p]]];
+
+      if (next == DFA_DEAD) {
+        return 0;
+      }
+      if (next == DFA_DONE) {
+        if (prog.has_dollar) {
+          return 0;
+        }
+        dest[0] = Match{0, p - 1};
+        return 1;
+      }
+      state = next;
+    }
+
+    if (!accepts_at_end[state]) {
+      return 0;
+    }
+    dest[0] = Match{0, line_len - 1};
+    return 1;
+  }
+
+  // every start at once in one pass over the line, the same as
+  // _pikevm_matches. threads in the same state at the same byte end up in
+  // the same place, so they're run as one group.
+  template <bool first_only>
+  static int _pikevm(const unsigned char *line, int line_len, Match *dest) {
+    if constexpr (!first_only) {
+      for (int c = 0; c < line_len; c++) {
+        dest[c].end = NO_MATCH;
+      }
+    }
+
+    Groups a, b;
+    a.head.fill(-1);
+    b.head.fill(-1);
+    Groups *cur = &a;
+    Groups *next = &b;
+
+    for (int p = 0; p < line_len; p++) {
+      if constexpr (prefilter.kind != PREFILTER_NONE) {
+        if (cur->num_live == 0) {
+          // nothing is in flight, so jump straight to the next possible
+          // start.
+          p = _skip(line, line_len, p);
+          if (p == line_len) {
+            break;
+          }
+        }
+      }
+
+      if constexpr (!first_only) {
+        dest[p].start = -1;
+      }
+      _group_push<first_only>(cur, dest, 0, p, p);
+
+      int byte_class = classes.byte_class[line[p]];
+      for (int i = 0; i < cur->num_live; i++) {
+        int s = cur->live[i];
+        int first = cur->head[s];
+        cur->head[s] = -1;
+
+        uint16_t t = dfa[s * n_classes + byte_class];
+        if (t < DFA_DEAD) {
+          _group_push<first_only>(next, dest, t, first, cur->tail[s]);
+        } else if (t == DFA_DONE && !prog.has_dollar) {
+          // the match ended on the byte before this one.
+          if constexpr (first_only) {
+            return 1;
+          } else {
+            for (int c = first; c >= 0; c = dest[c].start) {
+              dest[c].end = p - 1;
+            }
+          }
+        }
+      }
+      cur->num_live = 0;
+
+      Groups *tmp = cur;
+      cur = next;
+      next = tmp;
+    }
+
+    // whatever is still running got to the end of the line.
+    for (int i = 0; i < cur->num_live; i++) {
+      int s = cur->live[i];
+      if (!accepts_at_end[s]) {
+        continue;
+      }
+      if constexpr (first_only) {
+        return 1;
+      } else {
+        for (int c = cur->head[s]; c >= 0; c = dest[c].start) {
+          dest[c].end = line_len - 1;
+        }
+      }
+    }
+
+    if constexpr (first_only) {
+      return 0;
+    } else {
+      // the starts only ever get packed down, so this can't write over one
+      // it hasn't read yet.
+      int num_matches = 0;
+      for (int c = 0; c < line_len; c++) {
+        if (dest[c].end != NO_MATCH) {
+          dest[num_matches++] = Match{c, dest[c].end};
+        }
+      }
+      return num_matches;
+    }
+  }
+
+  template <bool first_only>
+  static int _run(std::string_view line, Match *dest) {
+    const unsigned char *bytes = (const unsigned char *)line.data();
+    int line_len = (int)line.size();
+
+    if constexpr (prog.num_pairs == 0) {
+      // an empty pattern matches nothing at every start, and with a caret
+      // that includes the start of an empty line.
+      int num_matches = 0;
+      int up_to = prog.has_caret ? 1 : line_len;
+      for (int c = 0; c < up_to; c++) {
+        if (prog.has_dollar && c != line_len) {
+          continue;
+        }
+        dest[num_matches++] = Match{c, c - 1};
+        if (first_only) {
+          break;
+        }
+      }
+      return num_matches;
+    } else if constexpr (prog.has_caret) {
+      return _onepass(bytes, line_len, dest);
+    } else {
+      return _pikevm<first_only>(bytes, line_len, dest);
+    }
+  }
+};
+
+} // namespace re
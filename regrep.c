@@ -0,0 +1,358 @@
+// regrep: grep, driven by libregex.
+//
+//   regrep [-c | -l | -o] [-n] [-U] [-j threads] pattern [file...]
+//
+// regular files are mmap'd and scanned in place, a whole file per call to
+// re_scan_lines. anything that can't be mapped (stdin, pipes) is streamed
+// through read(). files are spread over a pool of threads that share one
+// compiled pattern, each with its own scratch.
+
+#define _GNU_SOURCE // memrchr
+#include "libregex.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_CHUNK (1 << 16)
+
+typedef enum OutputMode {
+  OUT_LINES, // the matching lines.
+  OUT_COUNT, // -c, how many lines matched per file.
+  OUT_FILES, // -l, just the names of the files with a match.
+  OUT_ONLY,  // -o, each match on its own line.
+} OutputMode;
+
+typedef struct Options {
+  OutputMode mode;
+  int line_numbers;
+  int show_names;
+  int num_threads;
+} Options;
+
+// a growable byte buffer, for batching up output.
+typedef struct Buf {
+  char *data;
+  long len;
+  long cap;
+} Buf;
+
+typedef struct Worker {
+  REScratch *scratch;
+  Buf out;
+} Worker;
+
+// the state of the file a worker is scanning.
+typedef struct FileScan {
+  const char *name;
+  long line_no; // the lines before the current buffer.
+  long count;
+  int stop;
+
+  // for -o, the line the last match was on and how far it's been printed.
+  const char *last_line;
+  int printed_to;
+} FileScan;
+
+static Options opts;
+static const REComp *compiled;
+
+static char **files;
+static int num_files;
+static int next_file;
+static int any_match;
+static int any_error;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _buf_write(Buf *b, const char *data, long len) {
+  if (b->len + len > b->cap) {
+    b->cap = (b->cap ? b->cap * 2 : 4096);
+    while (b->cap < b->len + len) {
+      b->cap *= 2;
+    }
+    b->data = realloc(b->data, b->cap);
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+// "name:" when there's a name, then n formatted with fmt when there's a fmt.
+static void _buf_prefix(Buf *b, const char *fmt, const char *name, long n) {
+  char tmp[64];
+  if (name) {
+    _buf_write(b, name, strlen(name));
+    _buf_write(b, ":", 1);
+  }
+  if (fmt) {
+    int len = snprintf(tmp, sizeof(tmp), fmt, n);
+    _buf_write(b, tmp, len);
+  }
+}
+
+// flush a whole file's output at once, so files never interleave.
+static void _flush(Worker *w) {
+  if (w->out.len == 0) {
+    return;
+  }
+  pthread_mutex_lock(&out_lock);
+  fwrite(w->out.data, 1, w->out.len, stdout);
+  pthread_mutex_unlock(&out_lock);
+  w->out.len = 0;
+}
+
+// where a scan is up to, for the callback.
+typedef struct ScanCtx {
+  Worker *w;
+  FileScan *f;
+  const char *buf;
+} ScanCtx;
+
+// handle one match. returns nonzero when the rest of the file can be skipped.
+static int _match(const LineMatch *lm, void *arg) {
+  ScanCtx *ctx = arg;
+  FileScan *f = ctx->f;
+  Buf *out = &ctx->w->out;
+  const char *line = ctx->buf + lm->line_offset;
+  long line_no = f->line_no + lm->line_no;
+
+  if (opts.mode != OUT_ONLY) {
+    // everything but -o scans with RE_SCAN_ONE_PER_LINE, so this is the only
+    // call for this line.
+    f->count++;
+
+    if (opts.mode == OUT_FILES) {
+      f->stop = 1;
+      return 1;
+    }
+    if (opts.mode == OUT_LINES) {
+      _buf_prefix(out, opts.line_numbers ? "%ld:" : NULL,
+                  opts.show_names ? f->name : NULL, line_no);
+      _buf_write(out, line, lm->line_len);
+      _buf_write(out, "\n", 1);
+    }
+    return 0;
+  }
+
+  if (line != f->last_line) {
+    f->last_line = line;
+    f->printed_to = -1;
+    f->count++;
+  }
+
+  // every start gets reported, so only print the matches that don't overlap
+  // the last one printed.
+  Match m = lm->match;
+  if (m.start <= f->printed_to || m.end < m.start) {
+    return 0;
+  }
+  _buf_prefix(out, opts.line_numbers ? "%ld:" : NULL,
+              opts.show_names ? f->name : NULL, line_no);
+  _buf_write(out, line + m.start, m.end - m.start + 1);
+  _buf_write(out, "\n", 1);
+  f->printed_to = m.end;
+  return 0;
+}
+
+// scan every complete line in buf. the last line only counts as complete at the
+// end of the input. returns how many bytes were used up, or -1 if the file can
+// be skipped from here.
+static long _lines(Worker *w, FileScan *f, const char *buf, long len,
+                   int at_eof) {
+  long used = len;
+  if (!at_eof) {
+    const char *nl = memrchr(buf, '\n', len);
+    if (nl == NULL) {
+      return 0;
+    }
+    used = nl - buf + 1;
+  }
+
+  // the library only looks for line boundaries around its hits, so most lines
+  // of a selective search are never split out at all.
+  ScanCtx ctx = {.w = w, .f = f, .buf = buf};
+  int flags = (opts.mode == OUT_ONLY) ? 0 : RE_SCAN_ONE_PER_LINE;
+  f->last_line = NULL;
+  re_scan_lines(buf, used, compiled, w->scratch, flags, _match, &ctx);
+  if (f->stop) {
+    return -1;
+  }
+
+  // only a buffer that's continued in the next one needs its lines counted.
+  if (opts.line_numbers && !at_eof) {
+    for (const char *p = buf; (p = memchr(p, '\n', buf + used - p)); p++) {
+      f->line_no++;
+    }
+  }
+  return used;
+}
+
+static void _scan_stream(Worker *w, FileScan *f, int fd) {
+  long cap = READ_CHUNK * 2;
+  char *buf = malloc(cap);
+  long len = 0;
+
+  for (;;) {
+    if (cap - len < READ_CHUNK) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+
+    ssize_t got = read(fd, buf + len, cap - len);
+    if (got < 0) {
+      perror(f->name);
+      __atomic_store_n(&any_error, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    len += got;
+
+    long used = _lines(w, f, buf, len, got == 0);
+    if (used < 0 || got == 0) {
+      break;
+    }
+
+    // keep the partial line at the end around for the next read.
+    memmove(buf, buf + used, len - used);
+    len -= used;
+  }
+
+  free(buf);
+}
+
+static void _scan_file(Worker *w, const char *name) {
+  FileScan f = {.name = name};
+
+  int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY);
+  if (fd < 0) {
+    perror(name);
+    __atomic_store_n(&any_error, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+
+  if (map != MAP_FAILED) {
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    _lines(w, &f, map, st.st_size, 1);
+    munmap(map, st.st_size);
+  } else {
+    _scan_stream(w, &f, fd);
+  }
+
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+
+  if (f.count) {
+    __atomic_store_n(&any_match, 1, __ATOMIC_RELAXED);
+  }
+
+  if (opts.mode == OUT_COUNT) {
+    _buf_prefix(&w->out, "%ld\n", opts.show_names ? name : NULL, f.count);
+  } else if (opts.mode == OUT_FILES && f.count) {
+    _buf_write(&w->out, name, strlen(name));
+    _buf_write(&w->out, "\n", 1);
+  }
+  _flush(w);
+}
+
+static void *_worker(void *arg) {
+  (void)arg;
+  Worker w = {.scratch = re_scratch_alloc(compiled)};
+
+  for (;;) {
+    int i = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED);
+    if (i >= num_files) {
+      break;
+    }
+    _scan_file(&w, files[i]);
+  }
+
+  re_scratch_free(w.scratch);
+  free(w.out.data);
+  return NULL;
+}
+
+static void _usage(void) {
+  fprintf(stderr,
+          "usage: regrep [-c | -l | -o] [-n] [-U] [-j threads] pattern "
+          "[file...]\n");
+  exit(2);
+}
+
+int main(int argc, char *argv[]) {
+  int flags = 0;
+  opts.num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "clonUj:")) != -1) {
+    switch (opt) {
+    case 'c':
+      opts.mode = OUT_COUNT;
+      break;
+    case 'l':
+      opts.mode = OUT_FILES;
+      break;
+    case 'o':
+      opts.mode = OUT_ONLY;
+      break;
+    case 'n':
+      opts.line_numbers = 1;
+      break;
+    case 'U':
+      flags |= RE_UTF8;
+      break;
+    case 'j':
+      opts.num_threads = atoi(optarg);
+      break;
+    default:
+      _usage();
+    }
+  }
+
+  if (optind >= argc) {
+    _usage();
+  }
+
+  REComp *r = re_compile_flags(argv[optind], flags);
+  compiled = r;
+
+  static char *stdin_only[] = {"-"};
+  files = &argv[optind + 1];
+  num_files = argc - optind - 1;
+  if (num_files == 0) {
+    files = stdin_only;
+    num_files = 1;
+  }
+  opts.show_names = num_files > 1;
+
+  int num_threads = opts.num_threads;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (num_threads > num_files) {
+    num_threads = num_files;
+  }
+
+  if (num_threads == 1) {
+    _worker(NULL);
+  } else {
+    pthread_t threads[num_threads];
+    for (int i = 0; i < num_threads; i++) {
+      pthread_create(&threads[i], NULL, _worker, NULL);
+    }
+    for (int i = 0; i < num_threads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  re_free(r);
+  return any_error ? 2 : (any_match ? 0 : 1);
+}
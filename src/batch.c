@@ -0,0 +1,149 @@
+#include "engine.h"
+#include "libregex.h"
+#include <string.h>
+
+// how many rows go through the one-pass table at once. each row's next table
+// lookup depends on its last one, so walking several rows side by side gives
+// the cpu independent loads to overlap instead of waiting on each in turn.
+#define BATCH_LANES 4
+
+#define BITMAP_SET(bitmap, i) ((bitmap)[(i) / 64] |= (uint64_t)1 << ((i) % 64))
+
+typedef struct Lane {
+  long row;
+  const unsigned char *p;
+  const unsigned char *end;
+  int state;
+} Lane;
+
+// start the next row in a lane, skipping over the ones that can't match. rows
+// that are empty never match, same as in _onepass_matches. returns 0 when
+// there are no rows left.
+static int _lane_start(Lane *lane, const char *data, const int32_t *offsets,
+                       long *next_row, long n_rows) {
+  for (; *next_row < n_rows; (*next_row)++) {
+    long row = *next_row;
+    if (offsets[row + 1] > offsets[row]) {
+      lane->row = row;
+      lane->p = (const unsigned char *)data + offsets[row];
+      lane->end = (const unsigned char *)data + offsets[row + 1];
+      lane->state = 0;
+      (*next_row)++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// _onepass_matches, over BATCH_LANES rows at a time. a lane that finishes
+// its row picks up the next one straight away, so short and long rows don't
+// hold each other up.
+static long _onepass_batch(const char *data, const int32_t *offsets,
+                           long n_rows, const REComp *r, REScratch *scratch,
+                           uint64_t *bitmap) {
+  const uint16_t *dfa = r->dfa;
+  const unsigned char *byte_class = r->byte_class;
+  int n_classes = r->n_classes;
+
+  Lane lanes[BATCH_LANES];
+  int live[BATCH_LANES];
+  int num_live = 0;
+  long next_row = 0;
+  long num_matched = 0;
+
+  for (int i = 0; i < BATCH_LANES; i++) {
+    if (_lane_start(&lanes[i], data, offsets, &next_row, n_rows)) {
+      live[num_live++] = i;
+    }
+  }
+
+  while (num_live > 0) {
+    if (BUDGET_CHARGE(scratch, num_live)) {
+      return RE_BUDGET_EXCEEDED;
+    }
+    for (int j = 0; j < num_live; j++) {
+      Lane *lane = &lanes[live[j]];
+      int matched = -1;
+
+      const unsigned char *at = lane->p++;
+      uint16_t next = dfa[lane->state * n_classes + byte_class[*at]];
+      if (next == DFA_LOOKAHEAD) {
+        next = _dfa_lookahead(r, lane->state, (const char *)at,
+                              (const char *)lane->end);
+      }
+      if (next == DFA_DEAD) {
+        matched = 0;
+      } else if (next == DFA_DONE) {
+        matched = !r->has_dollar;
+      } else {
+        lane->state = next;
+        if (lane->p == lane->end) {
+          matched = _state_accepts_at_end(r, next);
+        }
+      }
+
+      if (matched < 0) {
+        continue;
+      }
+      if (matched) {
+        BITMAP_SET(bitmap, lane->row);
+        num_matched++;
+      }
+      if (!_lane_start(lane, data, offsets, &next_row, n_rows)) {
+        live[j--] = live[--num_live];
+      }
+    }
+  }
+
+  return num_matched;
+}
+
+long re_match_batch(const char *data, const int32_t *offsets, long n_rows,
+                    const REComp *compiled, REScratch *scratch,
+                    uint64_t *out_bitmap) {
+  memset(out_bitmap, 0, sizeof(uint64_t) * ((n_rows + 63) / 64));
+  _budget_start(scratch);
+  scratch->first_only = 1;
+
+  if (compiled->plan == PLAN_ONEPASS) {
+    return _onepass_batch(data, offsets, n_rows, compiled, scratch,
+                          out_bitmap);
+  }
+
+  long num_matched = 0;
+
+  if (compiled->plan == PLAN_LITERAL && !compiled->has_caret &&
+      !compiled->has_dollar) {
+    // a row matches exactly when the literal is somewhere in it.
+    for (long i = 0; i < n_rows; i++) {
+      const char *from = data + offsets[i];
+      int found = _literal_advance(compiled, &from, data + offsets[i + 1],
+                                   scratch);
+      if (found == RE_BUDGET_EXCEEDED) {
+        return RE_BUDGET_EXCEEDED;
+      }
+      if (found) {
+        BITMAP_SET(out_bitmap, i);
+        num_matched++;
+      }
+    }
+    return num_matched;
+  }
+
+  // everything else goes row by row through the usual engines, with the
+  // engines stopping at the first match.
+  Match m;
+  for (long i = 0; i < n_rows; i++) {
+    int found = _exec(data + offsets[i], offsets[i + 1] - offsets[i],
+                      compiled, scratch, &m);
+    if (found == RE_BUDGET_EXCEEDED) {
+      return RE_BUDGET_EXCEEDED;
+    }
+    if (found > 0) {
+      BITMAP_SET(out_bitmap, i);
+      num_matched++;
+    }
+  }
+
+  return num_matched;
+}
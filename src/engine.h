@@ -0,0 +1,134 @@
+#pragma once
+
+#include "libregex.h"
+
+// internal glue between the parser, the planner and the matching engines.
+// nothing in here is part of the public api.
+
+// what the thread transition function returns instead of a state when the
+// thread leaves the pattern.
+#define STATE_DONE -1 // the match ended right before this byte.
+#define STATE_DEAD -2 // this start can't match.
+// the byte leads a multibyte code point, and _state_next_utf8 has to look at
+// the rest of it.
+#define STATE_LOOKAHEAD -3
+
+// whether a single character is accepted by the object. _eat is built on top
+// of this, and the planner uses it to lower every object into a ByteSet.
+int _obj_accepts(const Obj *o, char to_match);
+
+struct REScratch {
+  // the pikevm thread groups: two generations of head, tail and live lists,
+  // each state_cap long. every head is -1 between calls.
+  int *groups;
+  int state_cap;
+
+  // two arrays line_cap long: the next start in the same group, and where the
+  // match from each start ended.
+  int *positions;
+  int line_cap;
+
+  // the budget, from re_scratch_set_budget. budget_left counts down from
+  // budget_grant to the next time the limits actually get looked at, so
+  // charging a step is just a decrement.
+  long max_steps;
+  long long deadline_ns;
+  long steps_used;
+  long budget_grant;
+  long budget_left;
+
+  // set by re_is_match, so the engines stop at the first match they find.
+  int first_only;
+
+  // room for a line's worth of matches, for the apis that collect them
+  // themselves.
+  Match *matches;
+  int matches_cap;
+};
+
+// charge the scratch for some engine work. true once the budget has run out,
+// at which point the engine should bail out with RE_BUDGET_EXCEEDED.
+#define BUDGET_CHARGE(scratch, steps)                                          \
+  (((scratch)->budget_left -= (steps)) < 0 && _budget_exhausted(scratch))
+
+// scratch.c
+// grow the scratch so it can run a pattern with n_states states over a line
+// of line_len bytes. only allocates when it has to.
+void _scratch_reserve(REScratch *scratch, int n_states, int line_len);
+// make sure scratch->matches can hold every match of a line_len line.
+void _scratch_reserve_matches(REScratch *scratch, int line_len);
+// reset the step count at the start of a call.
+void _budget_start(REScratch *scratch);
+int _budget_exhausted(REScratch *scratch);
+
+// utf8.c. the parsers take the pattern and the index to start at, and leave
+// the index right after whatever they consumed.
+int _utf8_decode(const char *s, uint32_t *cp);
+Utf8Class _utf8_code_point(const char *pattern, int *idx);
+Utf8Class _utf8_property(const char *pattern, int *idx);
+Utf8Class _utf8_class(const char *pattern, int *idx);
+Utf8Class _utf8_dot(void);
+// how many bytes of the line the class eats, or 0 if it doesn't match.
+int _utf8_eat_len(const Utf8Class *c, const char *line, const char *end);
+
+// plan.c
+void _plan(REComp *r);
+int _exec(const char *line, int line_len, const REComp *r,
+          REScratch *scratch, Match *dest);
+int _state_next(const REComp *r, int state, unsigned char b);
+// _state_next with the whole code point at p, for when that gives
+// STATE_LOOKAHEAD. end is the end of the line.
+int _state_next_utf8(const REComp *r, int state, const char *p,
+                     const char *end);
+int _state_accepts_at_end(const REComp *r, int state);
+const char *_prefilter_skip(const REComp *r, const char *from,
+                            const char *end);
+int _prefilter_advance(const REComp *r, const char **from, const char *end,
+                       REScratch *scratch);
+
+// onepass.c
+void _dfa_build(REComp *r);
+// split the classes in byte_class so none of them has bytes both in and out of
+// set. returns the new number of classes.
+int _byte_classes_split(unsigned char *byte_class, const ByteSet *set);
+// the table entry a DFA_LOOKAHEAD stands for, given the code point at p.
+uint16_t _dfa_lookahead(const REComp *r, int state, const char *p,
+                        const char *end);
+
+// pikevm.c. a set of thread groups, one per state, each a list of the starts
+// in that state linked through next_start.
+typedef struct Groups {
+  int *head; // per state, the first start in its group, or -1.
+  int *tail;
+  int *live; // the states that have a group right now.
+  int num_live;
+} Groups;
+// splice the starts first to last onto the group for state.
+void _group_push(Groups *g, int *next_start, int state, int first, int last);
+// empty out every group, so the heads are all -1 for the next call.
+void _groups_clear(Groups *g);
+
+// literal.c. like _prefilter_advance, but to the next occurrence of the
+// literal.
+int _literal_advance(const REComp *r, const char **from, const char *end,
+                     REScratch *scratch);
+
+// the engines. each one has the same contract as re_get_matches, but takes
+// the line length up front.
+int _interp_matches(const char *line, int line_len, const REComp *r,
+                    REScratch *scratch, Match *dest);
+int _literal_matches(const char *line, int line_len, const REComp *r,
+                     REScratch *scratch, Match *dest);
+int _shift_and_matches(const char *line, int line_len, const REComp *r,
+                       REScratch *scratch, Match *dest);
+int _pikevm_matches(const char *line, int line_len, const REComp *r,
+                    REScratch *scratch, Match *dest);
+int _onepass_matches(const char *line, int line_len, const REComp *r,
+                     REScratch *scratch, Match *dest);
+
+// fill in the per-pair spans for a match that starts at start, or return 0 if
+// there's no match there.
+int _interp_spans(const char *line, int line_len, const REComp *r, int start,
+                  Match *spans);
+int _onepass_spans(const char *line, int line_len, const REComp *r,
+                   Match *spans);
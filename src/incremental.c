@@ -0,0 +1,558 @@
+#include "engine.h"
+#include "libregex.h"
+#include <stdlib.h>
+#include <string.h>
+
+// an REDoc runs the same forward pass as the pikevm over the whole text, and
+// every DOC_CHUNK bytes it saves the thread groups it had there. the threads
+// at a position are everything the rest of the pass depends on, so after an
+// edit the pass can pick up from the last checkpoint before it. once the new
+// pass comes out of the edit with the same threads an old checkpoint had,
+// everything after that is what the old pass found, moved over by however
+// much the edit changed the length.
+//
+// a checkpoint keeps each thread's start as a distance back from where the
+// checkpoint is, so moving a checkpoint is just changing its position. that
+// only holds for threads that started after the edit, so only checkpoints
+// where every thread did can end a rescan.
+//
+// a multibyte utf-8 step reads the rest of the code point when it takes the
+// first byte of one, so the threads at a checkpoint depend on the few bytes
+// after it too. a rescan restarts from a checkpoint far enough before the
+// edit that it never saw any of it.
+
+#define DOC_CHUNK 4096
+
+#define NO_CHECKPOINT -1
+
+typedef struct Thread {
+  int state;
+  int back; // how far before the checkpoint the thread started.
+} Thread;
+
+typedef struct Checkpoint {
+  long pos;
+  Thread *threads; // sorted, so two checkpoints compare with a memcmp.
+  int num_threads;
+} Checkpoint;
+
+typedef struct MatchList {
+  Match *data;
+  long len;
+  long cap;
+} MatchList;
+
+typedef struct CheckpointList {
+  Checkpoint *data;
+  int len;
+  int cap;
+} CheckpointList;
+
+struct REDoc {
+  const REComp *r;
+  char *text;
+  long len;
+  long cap;
+
+  // whether the pattern runs on thread states at all. patterns that are too
+  // big to have states get rescanned whole.
+  int incremental;
+  REScratch *scratch;
+
+  MatchList matches;
+  CheckpointList checkpoints;
+  MatchList added;
+  MatchList removed;
+};
+
+static void _match_push(MatchList *l, Match m) {
+  if (l->len == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 64;
+    l->data = realloc(l->data, sizeof(Match) * l->cap);
+  }
+  l->data[l->len++] = m;
+}
+
+static void _checkpoint_push(CheckpointList *l, Checkpoint cp) {
+  if (l->len == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 16;
+    l->data = realloc(l->data, sizeof(Checkpoint) * l->cap);
+  }
+  l->data[l->len++] = cp;
+}
+
+static int _thread_cmp(const void *a, const void *b) {
+  const Thread *x = a;
+  const Thread *y = b;
+  if (x->state != y->state) {
+    return x->state - y->state;
+  }
+  return x->back - y->back;
+}
+
+static int _match_cmp(const void *a, const void *b) {
+  return ((const Match *)a)->start - ((const Match *)b)->start;
+}
+
+static Checkpoint _checkpoint_take(const Groups *g, const int *next_start,
+                                   long pos) {
+  int n = 0;
+  for (int i = 0; i < g->num_live; i++) {
+    for (int c = g->head[g->live[i]]; c >= 0; c = next_start[c]) {
+      n++;
+    }
+  }
+
+  Checkpoint cp = {.pos = pos, .num_threads = n};
+  cp.threads = malloc(sizeof(Thread) * (n ? n : 1));
+  n = 0;
+  for (int i = 0; i < g->num_live; i++) {
+    int s = g->live[i];
+    for (int c = g->head[s]; c >= 0; c = next_start[c]) {
+      cp.threads[n++] = (Thread){.state = s, .back = pos - c};
+    }
+  }
+  qsort(cp.threads, n, sizeof(Thread), _thread_cmp);
+  return cp;
+}
+
+// can a rescan stop at new and use everything the old pass did from old on?
+static int _converged(const Checkpoint *new, const Checkpoint *old,
+                      long edit_end) {
+  if (new->num_threads != old->num_threads ||
+      memcmp(new->threads, old->threads, sizeof(Thread) * new->num_threads)) {
+    return 0;
+  }
+  for (int i = 0; i < new->num_threads; i++) {
+    if (new->pos - new->threads[i].back < edit_end) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// the state s goes to on the byte at p. end is the end of the text, for a
+// multibyte step that has to see the whole code point.
+static int _step(const REComp *r, int s, const char *p, const char *end) {
+  unsigned char byte = *p;
+  int t;
+  if (r->dfa) {
+    uint16_t entry = r->dfa[s * r->n_classes + r->byte_class[byte]];
+    t = (entry == DFA_DONE)        ? STATE_DONE
+        : (entry == DFA_DEAD)      ? STATE_DEAD
+        : (entry == DFA_LOOKAHEAD) ? STATE_LOOKAHEAD
+                                   : entry;
+  } else {
+    t = _state_next(r, s, byte);
+  }
+  if (t == STATE_LOOKAHEAD) {
+    t = _state_next_utf8(r, s, p, end);
+  }
+  return t;
+}
+
+// run the pass from the checkpoint at from, putting the matches it finds in
+// found and the checkpoints it takes in fresh. old are the checkpoints of the
+// last pass that come after the edit, already moved to where they are now.
+// returns the one it converged with, or NO_CHECKPOINT if it ran to the end.
+static int _scan(REDoc *doc, const Checkpoint *from, const Checkpoint *old,
+                 int num_old, long edit_end, MatchList *found,
+                 CheckpointList *fresh) {
+  const REComp *r = doc->r;
+  const char *text = doc->text;
+  long len = doc->len;
+
+  _scratch_reserve(doc->scratch, r->n_states, len);
+  int cap = doc->scratch->state_cap;
+  int *groups = doc->scratch->groups;
+  Groups a = {.head = groups, .tail = groups + cap, .live = groups + 2 * cap};
+  Groups b = {.head = groups + 3 * cap, .tail = groups + 4 * cap,
+              .live = groups + 5 * cap};
+  int *next_start = doc->scratch->positions;
+  Groups *cur = &a;
+  Groups *next = &b;
+
+  for (int i = 0; i < from->num_threads; i++) {
+    int start = from->pos - from->threads[i].back;
+    next_start[start] = -1;
+    _group_push(cur, next_start, from->threads[i].state, start, start);
+  }
+
+  int converged = NO_CHECKPOINT;
+  int next_old = 0;
+  long p;
+  for (p = from->pos; p < len; p++) {
+    while (next_old < num_old && old[next_old].pos < p) {
+      next_old++;
+    }
+    int at_old = next_old < num_old && old[next_old].pos == p && p >= edit_end;
+    int at_chunk = p > from->pos && (p - from->pos) % DOC_CHUNK == 0;
+
+    if (at_old || at_chunk) {
+      Checkpoint cp = _checkpoint_take(cur, next_start, p);
+      if (at_old && _converged(&cp, &old[next_old], edit_end)) {
+        free(cp.threads);
+        converged = next_old;
+        break;
+      }
+      if (at_chunk) {
+        _checkpoint_push(fresh, cp);
+      } else {
+        free(cp.threads);
+      }
+    }
+
+    if (!r->has_caret || p == 0) {
+      next_start[p] = -1;
+      _group_push(cur, next_start, 0, p, p);
+    } else if (cur->num_live == 0) {
+      // nothing will ever be in flight again.
+      p = len;
+      break;
+    }
+
+    for (int i = 0; i < cur->num_live; i++) {
+      int s = cur->live[i];
+      int first = cur->head[s];
+      cur->head[s] = -1;
+
+      int t = _step(r, s, text + p, text + len);
+      if (t >= 0) {
+        _group_push(next, next_start, t, first, cur->tail[s]);
+      } else if (t == STATE_DONE && !r->has_dollar) {
+        for (int c = first; c >= 0; c = next_start[c]) {
+          _match_push(found, (Match){.start = c, .end = p - 1});
+        }
+      }
+    }
+    cur->num_live = 0;
+
+    Groups *tmp = cur;
+    cur = next;
+    next = tmp;
+  }
+
+  for (int i = 0; i < cur->num_live; i++) {
+    int s = cur->live[i];
+    if (p == len && _state_accepts_at_end(r, s)) {
+      for (int c = cur->head[s]; c >= 0; c = next_start[c]) {
+        _match_push(found, (Match){.start = c, .end = len - 1});
+      }
+    }
+  }
+  _groups_clear(cur);
+
+  if (found->len) {
+    qsort(found->data, found->len, sizeof(Match), _match_cmp);
+  }
+  return converged;
+}
+
+// where an old match is now, or 0 if it overlapped the edit.
+static int _match_moved(Match m, long offset, long old_end, long delta,
+                        Match *moved) {
+  if (m.end < offset) {
+    *moved = m;
+    return 1;
+  }
+  if (m.start >= old_end) {
+    *moved = (Match){.start = m.start + delta, .end = m.end + delta};
+    return 1;
+  }
+  return 0;
+}
+
+// the old matches from lo to hi were redone as found. the ones that didn't
+// come out the same, wherever they moved to, are the delta.
+static void _diff(REDoc *doc, const Match *old, long num_old,
+                  const MatchList *found, long offset, long old_end,
+                  long delta) {
+  long j = 0;
+  for (long i = 0; i < num_old; i++) {
+    Match moved;
+    if (!_match_moved(old[i], offset, old_end, delta, &moved)) {
+      _match_push(&doc->removed, old[i]);
+      continue;
+    }
+    while (j < found->len && found->data[j].start < moved.start) {
+      _match_push(&doc->added, found->data[j++]);
+    }
+    if (j < found->len && found->data[j].start == moved.start &&
+        found->data[j].end == moved.end) {
+      j++;
+    } else {
+      _match_push(&doc->removed, old[i]);
+    }
+  }
+  while (j < found->len) {
+    _match_push(&doc->added, found->data[j++]);
+  }
+}
+
+// the whole text through the usual engines, for patterns that can't be
+// checkpointed.
+static void _scan_whole(REDoc *doc, MatchList *found) {
+  _scratch_reserve_matches(doc->scratch, doc->len);
+  _budget_start(doc->scratch);
+  doc->scratch->first_only = 0;
+  int n = _exec(doc->text, doc->len, doc->r, doc->scratch,
+                doc->scratch->matches);
+  for (int i = 0; i < n; i++) {
+    _match_push(found, doc->scratch->matches[i]);
+  }
+}
+
+REDoc *re_doc_new(const REComp *compiled, const char *text, long len) {
+  REDoc *doc = calloc(1, sizeof(REDoc));
+  doc->r = compiled;
+  doc->cap = len ? len : 1;
+  doc->text = malloc(doc->cap);
+  memcpy(doc->text, text, len);
+  doc->len = len;
+  doc->scratch = re_scratch_alloc(compiled);
+  doc->incremental =
+      compiled->plan != PLAN_INTERP && compiled->n_states <= MAX_STATES;
+
+  if (!doc->incremental) {
+    _scan_whole(doc, &doc->matches);
+    return doc;
+  }
+
+  Checkpoint start = {.pos = 0, .threads = malloc(sizeof(Thread))};
+  _checkpoint_push(&doc->checkpoints, start);
+  _scan(doc, &start, NULL, 0, 0, &doc->matches, &doc->checkpoints);
+  return doc;
+}
+
+// the first match that starts at or after start.
+static long _lower_bound(const Match *m, long n, long start) {
+  long lo = 0;
+  long hi = n;
+  while (lo < hi) {
+    long mid = lo + (hi - lo) / 2;
+    if (m[mid].start < start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int _long_cmp(const void *a, const void *b) {
+  long x = *(const long *)a;
+  long y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+// work out the new match list from the old one and a rescan from restart that
+// converged with the old pass at resume, in the old pass's positions. a match
+// is decided at end + 1, when the pass that found it saw it end: the old ones
+// decided before restart stay put, the ones decided from resume on move with
+// the text, and the ones in between were redone as found.
+static void _splice(REDoc *doc, const Checkpoint *from, long resume,
+                    MatchList *found, long offset, long old_end, long shift) {
+  MatchList old = doc->matches;
+  long restart = from->pos;
+  long prefix_end = _lower_bound(old.data, old.len, restart);
+  long suffix_start = _lower_bound(old.data, old.len, resume);
+
+  // the old matches that start before restart but weren't decided by then
+  // were threads in flight at the restart, so the checkpoint says which.
+  long *spanning = malloc(sizeof(long) * (from->num_threads + 1));
+  int num_spanning = 0;
+  for (int i = 0; i < from->num_threads; i++) {
+    long start = restart - from->threads[i].back;
+    long j = _lower_bound(old.data, prefix_end, start);
+    if (j < prefix_end && old.data[j].start == start) {
+      spanning[num_spanning++] = j;
+    }
+  }
+  qsort(spanning, num_spanning, sizeof(long), _long_cmp);
+
+  MatchList redone = {0};
+  for (int i = 0; i < num_spanning; i++) {
+    _match_push(&redone, old.data[spanning[i]]);
+  }
+
+  // between restart and resume, the matches are either redone or decided
+  // late enough to move. the ones that move go in with found.
+  MatchList moved = {0};
+  long y = 0;
+  for (long j = prefix_end; j < suffix_start; j++) {
+    Match m = old.data[j];
+    if (m.end + 1 < resume) {
+      _match_push(&redone, m);
+      continue;
+    }
+    m = (Match){.start = m.start + shift, .end = m.end + shift};
+    while (y < found->len && found->data[y].start < m.start) {
+      _match_push(&moved, found->data[y++]);
+    }
+    _match_push(&moved, m);
+  }
+  while (y < found->len) {
+    _match_push(&moved, found->data[y++]);
+  }
+
+  _diff(doc, redone.data, redone.len, found, offset, old_end, shift);
+  free(redone.data);
+
+  // the untouched prefix goes across in runs between the spanning matches and
+  // wherever something from moved has to go in.
+  long num_suffix = old.len - suffix_start;
+  MatchList next = {0};
+  next.cap = prefix_end - num_spanning + moved.len + num_suffix;
+  next.data = malloc(sizeof(Match) * (next.cap ? next.cap : 1));
+
+  long i = 0;
+  int k = 0;
+  for (long m = 0; m <= moved.len; m++) {
+    long upto = (m < moved.len)
+                    ? _lower_bound(old.data + i, prefix_end - i,
+                                   moved.data[m].start) + i
+                    : prefix_end;
+    while (i < upto) {
+      long run_end = (k < num_spanning && spanning[k] < upto) ? spanning[k]
+                                                                : upto;
+      memcpy(next.data + next.len, old.data + i, sizeof(Match) * (run_end - i));
+      next.len += run_end - i;
+      i = run_end;
+      if (k < num_spanning && spanning[k] == i) {
+        i++;
+        k++;
+      }
+    }
+    if (m < moved.len) {
+      next.data[next.len++] = moved.data[m];
+    }
+  }
+
+  for (long j = suffix_start; j < old.len; j++) {
+    Match m = old.data[j];
+    next.data[next.len++] =
+        (Match){.start = m.start + shift, .end = m.end + shift};
+  }
+
+  free(spanning);
+  free(moved.data);
+  free(old.data);
+  doc->matches = next;
+}
+
+void re_doc_edit(REDoc *doc, long offset, long deleted, const char *inserted,
+                 long inserted_len, REDelta *delta) {
+  long old_len = doc->len;
+  long old_end = offset + deleted;
+  long shift = inserted_len - deleted;
+
+  if (doc->len + shift > doc->cap) {
+    while (doc->cap < doc->len + shift) {
+      doc->cap *= 2;
+    }
+    doc->text = realloc(doc->text, doc->cap);
+  }
+  memmove(doc->text + offset + inserted_len, doc->text + old_end,
+          old_len - old_end);
+  memcpy(doc->text + offset, inserted, inserted_len);
+  doc->len += shift;
+
+  doc->added.len = 0;
+  doc->removed.len = 0;
+  MatchList found = {0};
+
+  if (!doc->incremental) {
+    _scan_whole(doc, &found);
+    _diff(doc, doc->matches.data, doc->matches.len, &found, offset, old_end,
+          shift);
+    free(doc->matches.data);
+    doc->matches = found;
+  } else {
+    // restart from the last checkpoint whose threads never read the edit.
+    // with multibyte steps, the byte before a checkpoint can start a code
+    // point whose last 3 bytes are the ones from the checkpoint on.
+    long reach = doc->r->has_multibyte ? 3 : 0;
+    CheckpointList *cps = &doc->checkpoints;
+    int from = 0;
+    while (from + 1 < cps->len && cps->data[from + 1].pos + reach <= offset) {
+      from++;
+    }
+
+    // the checkpoints after the edit move with the text. the ones inside it
+    // are gone.
+    int first_old = from + 1;
+    while (first_old < cps->len && cps->data[first_old].pos < old_end) {
+      free(cps->data[first_old].threads);
+      first_old++;
+    }
+    for (int i = first_old; i < cps->len; i++) {
+      cps->data[i].pos += shift;
+    }
+
+    CheckpointList fresh = {0};
+    int converged =
+        _scan(doc, &cps->data[from], &cps->data[first_old],
+              cps->len - first_old, offset + inserted_len, &found, &fresh);
+
+    // where the old pass takes over again, in its own positions.
+    long resume = old_len + 1;
+    int resume_cp = cps->len;
+    if (converged != NO_CHECKPOINT) {
+      resume_cp = first_old + converged;
+      resume = cps->data[resume_cp].pos - shift;
+    }
+
+    _splice(doc, &cps->data[from], resume, &found, offset, old_end, shift);
+    free(found.data);
+
+    // and the same for the checkpoints.
+    CheckpointList next = {0};
+    for (int j = 0; j <= from; j++) {
+      _checkpoint_push(&next, cps->data[j]);
+    }
+    for (int j = 0; j < fresh.len; j++) {
+      _checkpoint_push(&next, fresh.data[j]);
+    }
+    for (int j = first_old; j < cps->len; j++) {
+      if (j < resume_cp) {
+        free(cps->data[j].threads);
+      } else {
+        _checkpoint_push(&next, cps->data[j]);
+      }
+    }
+    free(fresh.data);
+    free(cps->data);
+    *cps = next;
+  }
+
+  if (delta) {
+    *delta = (REDelta){
+        .added = doc->added.data,
+        .num_added = doc->added.len,
+        .removed = doc->removed.data,
+        .num_removed = doc->removed.len,
+    };
+  }
+}
+
+const Match *re_doc_matches(const REDoc *doc, long *num_matches) {
+  *num_matches = doc->matches.len;
+  return doc->matches.data;
+}
+
+void re_doc_free(REDoc *doc) {
+  if (!doc) {
+    return;
+  }
+
+  for (int i = 0; i < doc->checkpoints.len; i++) {
+    free(doc->checkpoints.data[i].threads);
+  }
+  free(doc->checkpoints.data);
+  free(doc->matches.data);
+  free(doc->added.data);
+  free(doc->removed.data);
+  free(doc->text);
+  re_scratch_free(doc->scratch);
+  free(doc);
+}
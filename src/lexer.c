@@ -0,0 +1,269 @@
+#include "engine.h"
+#include "libregex.h"
+#include "macros.h"
+#include <stdlib.h>
+#include <string.h>
+
+// a rule matched from a given start is a single thread, since every
+// repetition is possessive. so running all the rules at once from the start
+// of a token is just a tuple of thread states, one per rule, and the lexer is
+// the automaton over those tuples. there can be far too many tuples to build
+// the whole thing up front, so it's built lazily: a transition is worked out
+// with _state_next the first time the lexer takes it, then read from the
+// table after that. if the table fills up it's thrown away and started over.
+
+#define LEX_MAX_STATES 1024
+
+#define LEX_DEAD -1    // every rule is out.
+#define LEX_UNKNOWN -2 // not worked out yet.
+#define LEX_FULL -3    // no room for another state.
+
+#define RULE_DEAD 0xffff
+
+struct RELexer {
+  int n_rules;
+  REComp **rules;
+  int *ids;
+
+  unsigned char byte_class[256];
+  unsigned char rep[256]; // one byte from each class.
+  int n_classes;
+
+  // there are two starts: one for the start of the input, and one for
+  // everywhere else, where rules with a ^ are out. without any ^ they're the
+  // same state.
+  uint16_t *start_tuples;
+  int start_first;
+  int start_rest;
+
+  // state i is the tuple at tuples[i * n_rules], with RULE_DEAD for the rules
+  // that are out.
+  uint16_t *tuples;
+  int n_states;
+  int *trans; // per state and class, the next state, LEX_DEAD or LEX_UNKNOWN.
+  // per state and class, the first rule whose match ended right before this
+  // byte, or -1.
+  int16_t *accept;
+  // per state, the first rule that matches if the input ends there, or -1.
+  int16_t *accept_at_end;
+  int *hash; // open addressing over the tuples, holding state numbers or -1.
+};
+
+#define HASH_SLOTS (2 * LEX_MAX_STATES)
+
+static unsigned _tuple_hash(const uint16_t *tuple, int n) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++) {
+    h = (h ^ tuple[i]) * 16777619u;
+  }
+  return h;
+}
+
+// the state for the tuple, adding it if it's new. returns LEX_FULL when it's
+// new and there's no room for it.
+static int _state_add(RELexer *lx, const uint16_t *tuple) {
+  int n = lx->n_rules;
+  unsigned slot = _tuple_hash(tuple, n) % HASH_SLOTS;
+
+  for (; lx->hash[slot] >= 0; slot = (slot + 1) % HASH_SLOTS) {
+    int s = lx->hash[slot];
+    if (memcmp(&lx->tuples[s * n], tuple, sizeof(uint16_t) * n) == 0) {
+      return s;
+    }
+  }
+
+  if (lx->n_states == LEX_MAX_STATES) {
+    return LEX_FULL;
+  }
+
+  int s = lx->n_states++;
+  lx->hash[slot] = s;
+  memcpy(&lx->tuples[s * n], tuple, sizeof(uint16_t) * n);
+
+  for (int c = 0; c < lx->n_classes; c++) {
+    lx->trans[s * lx->n_classes + c] = LEX_UNKNOWN;
+    lx->accept[s * lx->n_classes + c] = -1;
+  }
+
+  lx->accept_at_end[s] = -1;
+  for (int i = 0; i < n; i++) {
+    if (tuple[i] != RULE_DEAD &&
+        _state_accepts_at_end(lx->rules[i], tuple[i])) {
+      lx->accept_at_end[s] = i;
+      break;
+    }
+  }
+
+  return s;
+}
+
+// throw every state away, apart from the starts.
+static void _states_reset(RELexer *lx) {
+  lx->n_states = 0;
+  memset(lx->hash, -1, sizeof(int) * HASH_SLOTS);
+  lx->start_first = _state_add(lx, &lx->start_tuples[0]);
+  lx->start_rest = _state_add(lx, &lx->start_tuples[lx->n_rules]);
+}
+
+// take the transition out of state s on a byte of class c. sets *accept to the
+// rule that matched right before the byte, if any.
+static int _lex_step(RELexer *lx, int s, int c, int *accept) {
+  int idx = s * lx->n_classes + c;
+  if (lx->trans[idx] != LEX_UNKNOWN) {
+    *accept = lx->accept[idx];
+    return lx->trans[idx];
+  }
+
+  int n = lx->n_rules;
+  const uint16_t *tuple = &lx->tuples[s * n];
+  uint16_t next[n];
+  int all_dead = 1;
+  *accept = -1;
+
+  for (int i = 0; i < n; i++) {
+    next[i] = RULE_DEAD;
+    if (tuple[i] == RULE_DEAD) {
+      continue;
+    }
+
+    const REComp *r = lx->rules[i];
+    int t = _state_next(r, tuple[i], lx->rep[c]);
+    if (t >= 0) {
+      next[i] = t;
+      all_dead = 0;
+    } else if (t == STATE_DONE && !r->has_dollar && *accept < 0) {
+      *accept = i;
+    }
+  }
+
+  if (all_dead) {
+    lx->trans[idx] = LEX_DEAD;
+    lx->accept[idx] = *accept;
+    return LEX_DEAD;
+  }
+
+  int to = _state_add(lx, next);
+  if (to == LEX_FULL) {
+    // s is about to be gone, so there's nowhere to remember this transition.
+    _states_reset(lx);
+    return _state_add(lx, next);
+  }
+
+  lx->trans[idx] = to;
+  lx->accept[idx] = *accept;
+  return to;
+}
+
+RELexer *re_lexer_compile(const LexRule *rules, int n_rules) {
+  RELexer *lx = calloc(1, sizeof(RELexer));
+  lx->n_rules = n_rules;
+  lx->rules = calloc(n_rules, sizeof(REComp *));
+  lx->ids = malloc(sizeof(int) * n_rules);
+  lx->start_tuples = malloc(sizeof(uint16_t) * 2 * n_rules);
+
+  memset(lx->byte_class, 0, sizeof(lx->byte_class));
+  lx->n_classes = 1;
+
+  for (int i = 0; i < n_rules; i++) {
+    REComp *r = re_compile(rules[i].pattern);
+    lx->rules[i] = r;
+    lx->ids[i] = rules[i].id;
+
+    if (r->n_states > MAX_STATES) {
+      ERROR("lexer rule '%s' has too many states.", rules[i].pattern);
+      re_lexer_free(lx);
+      return NULL;
+    }
+
+    for (int j = 0; j < r->num_pairs; j++) {
+      lx->n_classes = _byte_classes_split(lx->byte_class, &r->steps[j].set);
+    }
+
+    // an empty pattern only ever matches nothing, which is never a token.
+    int live = r->num_pairs > 0;
+    lx->start_tuples[i] = live ? 0 : RULE_DEAD;
+    lx->start_tuples[n_rules + i] = (live && !r->has_caret) ? 0 : RULE_DEAD;
+  }
+
+  for (int b = 255; b >= 0; b--) {
+    lx->rep[lx->byte_class[b]] = b;
+  }
+
+  lx->tuples = malloc(sizeof(uint16_t) * LEX_MAX_STATES * n_rules);
+  lx->trans = malloc(sizeof(int) * LEX_MAX_STATES * lx->n_classes);
+  lx->accept = malloc(sizeof(int16_t) * LEX_MAX_STATES * lx->n_classes);
+  lx->accept_at_end = malloc(sizeof(int16_t) * LEX_MAX_STATES);
+  lx->hash = malloc(sizeof(int) * HASH_SLOTS);
+  _states_reset(lx);
+
+  return lx;
+}
+
+long re_lex(RELexer *lx, const char *input, long len, long from,
+            Token *tokens, long max_tokens) {
+  long p = from;
+  long num_tokens = 0;
+
+  while (p < len && num_tokens < max_tokens) {
+    int s = (p == 0) ? lx->start_first : lx->start_rest;
+    long best_len = 0;
+    int best_rule = -1;
+
+    long q;
+    for (q = p; q < len; q++) {
+      int accept;
+      int c = lx->byte_class[(unsigned char)input[q]];
+      int to = _lex_step(lx, s, c, &accept);
+
+      // every match that ends later is longer, so the last one wins. a match
+      // that ended before the first byte is empty, and doesn't count.
+      if (accept >= 0 && q > p) {
+        best_len = q - p;
+        best_rule = accept;
+      }
+      if (to == LEX_DEAD) {
+        break;
+      }
+      s = to;
+    }
+
+    if (q == len && lx->accept_at_end[s] >= 0) {
+      best_len = len - p;
+      best_rule = lx->accept_at_end[s];
+    }
+
+    Token *t = &tokens[num_tokens++];
+    if (best_rule < 0) {
+      *t = (Token){.id = RE_LEX_ERROR, .start = p, .end = p};
+      p++;
+    } else {
+      *t = (Token){.id = lx->ids[best_rule],
+                   .start = p,
+                   .end = p + best_len - 1};
+      p += best_len;
+    }
+  }
+
+  return num_tokens;
+}
+
+void re_lexer_free(RELexer *lx) {
+  if (!lx) {
+    return;
+  }
+
+  for (int i = 0; i < lx->n_rules; i++) {
+    if (lx->rules[i]) {
+      re_free(lx->rules[i]);
+    }
+  }
+  free(lx->rules);
+  free(lx->ids);
+  free(lx->start_tuples);
+  free(lx->tuples);
+  free(lx->trans);
+  free(lx->accept);
+  free(lx->accept_at_end);
+  free(lx->hash);
+  free(lx);
+}
@@ -0,0 +1,104 @@
+#define _GNU_SOURCE // memmem, memrchr
+#include "engine.h"
+#include "libregex.h"
+#include <string.h>
+
+// re_scan_lines looks for the places a match could start in the whole buffer
+// first, and only works out which line that is once it has one. a line with
+// no candidate in it can't match, so it's skipped without ever being found.
+// a newline at the very end of the buffer ends the last line rather than
+// starting an empty one.
+
+// move *from on to the first place a match could involve, charging the scratch
+// for the bytes passed over. a match always contains the literal, and always
+// starts with a byte the prefilter is looking for. returns 1, 0 when there's
+// nothing left, or RE_BUDGET_EXCEEDED.
+static int _next_candidate(const REComp *r, const char **from,
+                           const char *end, REScratch *scratch) {
+  if (r->plan == PLAN_LITERAL) {
+    return _literal_advance(r, from, end, scratch);
+  }
+  return _prefilter_advance(r, from, end, scratch);
+}
+
+// can _next_candidate rule lines out? with a caret and no literal there's no
+// byte to look for, so every line has to be tried.
+static int _has_candidates(const REComp *r) {
+  return r->plan == PLAN_LITERAL || r->prefilter != PREFILTER_NONE;
+}
+
+static long _count_newlines(const char *from, const char *to) {
+  long count = 0;
+  while ((from = memchr(from, '\n', to - from)) != NULL) {
+    count++;
+    from++;
+  }
+  return count;
+}
+
+long re_scan_lines(const char *buf, long len, const REComp *compiled,
+                   REScratch *scratch, int flags, re_line_fn callback,
+                   void *ctx) {
+  const char *end = buf + len;
+  const char *cursor = buf;
+  int use_candidates = _has_candidates(compiled);
+
+  // line numbers are only counted up to the lines that get looked at.
+  const char *counted_to = buf;
+  long line_no = 1;
+  long num_reported = 0;
+
+  _budget_start(scratch);
+  scratch->first_only = (flags & RE_SCAN_ONE_PER_LINE) != 0;
+
+  while (cursor < end) {
+    const char *line = cursor;
+    if (use_candidates) {
+      const char *hit = cursor;
+      int found = _next_candidate(compiled, &hit, end, scratch);
+      if (found == RE_BUDGET_EXCEEDED) {
+        return RE_BUDGET_EXCEEDED;
+      }
+      if (!found) {
+        break;
+      }
+      const char *nl = memrchr(cursor, '\n', hit - cursor);
+      line = nl ? nl + 1 : cursor;
+    }
+
+    const char *line_end = memchr(line, '\n', end - line);
+    if (line_end == NULL) {
+      line_end = end;
+    }
+    int line_len = line_end - line;
+
+    _scratch_reserve_matches(scratch, line_len);
+    int num_matches =
+        _exec(line, line_len, compiled, scratch, scratch->matches);
+    if (num_matches == RE_BUDGET_EXCEEDED) {
+      return RE_BUDGET_EXCEEDED;
+    }
+
+    if (num_matches > 0) {
+      line_no += _count_newlines(counted_to, line);
+      counted_to = line;
+
+      LineMatch lm = {
+          .line_no = line_no,
+          .line_offset = line - buf,
+          .line_len = line_len,
+      };
+      for (int i = 0; i < num_matches; i++) {
+        lm.match = scratch->matches[i];
+        num_reported++;
+        if (callback(&lm, ctx)) {
+          return num_reported;
+        }
+      }
+    }
+
+    cursor = line_end + 1;
+  }
+
+  return num_reported;
+}
@@ -0,0 +1,139 @@
+#define _GNU_SOURCE // memmem
+#include "engine.h"
+#include "libregex.h"
+#include <string.h>
+
+// the whole pattern is a plain string. every occurrence is a match, including
+// the overlapping ones, since re_get_matches tries every start.
+int _literal_matches(const char *line, int line_len, const REComp *r,
+                     REScratch *scratch, Match *dest) {
+  int len = r->literal_len;
+  int num_matches = 0;
+
+  if (len > line_len) {
+    return 0;
+  }
+
+  if (r->has_caret || r->has_dollar) {
+    // there's only one place the literal could be.
+    int start = r->has_caret ? 0 : line_len - len;
+    if ((r->has_caret && r->has_dollar && len != line_len) ||
+        memcmp(line + start, r->literal, len) != 0) {
+      return 0;
+    }
+    dest[0] = (Match){.start = start, .end = start + len - 1};
+    return 1;
+  }
+
+  const char *end = line + line_len;
+  const char *cursor = line;
+  int found;
+  while ((found = _literal_advance(r, &cursor, end, scratch)) == 1) {
+    if (BUDGET_CHARGE(scratch, len)) {
+      return RE_BUDGET_EXCEEDED;
+    }
+
+    int start = cursor - line;
+    dest[num_matches] = (Match){.start = start, .end = start + len - 1};
+    num_matches++;
+    if (scratch->first_only) {
+      break;
+    }
+    cursor++;
+  }
+  if (found == RE_BUDGET_EXCEEDED) {
+    return RE_BUDGET_EXCEEDED;
+  }
+
+  return num_matches;
+}
+
+int _literal_advance(const REComp *r, const char **from, const char *end,
+                     REScratch *scratch) {
+  int len = r->literal_len;
+  const char *p = *from;
+  while (end - p >= len) {
+    // memmem goes a window at a time, so a line without the literal still
+    // gets charged as it goes. the windows overlap by len - 1 bytes, so an
+    // occurrence across the edge of one is found in the next.
+    const char *window_end = (end - p > RE_BUDGET_INTERVAL + len - 1)
+                                 ? p + RE_BUDGET_INTERVAL + len - 1
+                                 : end;
+    const char *hit = memmem(p, window_end - p, r->literal, len);
+    const char *next = hit ? hit : window_end - (len - 1);
+    if (BUDGET_CHARGE(scratch, next - p)) {
+      return RE_BUDGET_EXCEEDED;
+    }
+    if (hit != NULL) {
+      *from = hit;
+      return 1;
+    }
+    p = next;
+  }
+  return 0;
+}
+
+// every step has a fixed count, so the pattern is a fixed-width string of
+// byte sets. bit j of the state word is set when the last j + 1 bytes match
+// the first j + 1 positions of the pattern.
+int _shift_and_matches(const char *line, int line_len, const REComp *r,
+                       REScratch *scratch, Match *dest) {
+  int len = r->shift_len;
+  int num_matches = 0;
+
+  if (len > line_len) {
+    return 0;
+  }
+
+  if (r->has_caret || r->has_dollar) {
+    // only one start to check, so just check it.
+    int start = r->has_caret ? 0 : line_len - len;
+    if (r->has_caret && r->has_dollar && len != line_len) {
+      return 0;
+    }
+    for (int j = 0; j < len; j++) {
+      unsigned char b = line[start + j];
+      if (!((r->shift_masks[b] >> j) & 1)) {
+        return 0;
+      }
+    }
+    dest[0] = (Match){.start = start, .end = start + len - 1};
+    return 1;
+  }
+
+  const uint64_t *masks = r->shift_masks;
+  uint64_t accept = (uint64_t)1 << (len - 1);
+  uint64_t state = 0;
+
+  const char *end = line + line_len;
+  const char *cursor = line;
+  while (cursor < end) {
+    if (state == 0 && r->prefilter != PREFILTER_NONE) {
+      // nothing is in flight, so jump straight to the next possible start.
+      int found = _prefilter_advance(r, &cursor, end, scratch);
+      if (found == RE_BUDGET_EXCEEDED) {
+        return RE_BUDGET_EXCEEDED;
+      }
+      if (!found) {
+        break;
+      }
+    }
+
+    if (BUDGET_CHARGE(scratch, 1)) {
+      return RE_BUDGET_EXCEEDED;
+    }
+
+    state = ((state << 1) | 1) & masks[(unsigned char)*cursor];
+    if (state & accept) {
+      int start = (cursor - line) - len + 1;
+      dest[num_matches] = (Match){.start = start, .end = start + len - 1};
+      num_matches++;
+      if (scratch->first_only) {
+        break;
+      }
+    }
+    cursor++;
+  }
+
+  return num_matches;
+}
@@ -0,0 +1,210 @@
+#include "engine.h"
+#include "libregex.h"
+#include <stdlib.h>
+#include <string.h>
+
+// every repetition in this syntax is possessive, so a thread reading a byte
+// has exactly one thing it can do: eat it in the current step, move on to the
+// next step, or stop. that makes the thread states a deterministic automaton
+// without any subset construction, and the table below is just _state_next
+// evaluated ahead of time for every state and byte class.
+
+int _byte_classes_split(unsigned char *byte_class, const ByteSet *set) {
+  // split[class][in set] is the new class for the members of the old one.
+  int split[256][2];
+  memset(split, -1, sizeof(split));
+  int n_classes = 0;
+
+  for (int b = 0; b < 256; b++) {
+    int in = BYTESET_HAS(set, b);
+    int *slot = &split[byte_class[b]][in];
+    if (*slot < 0) {
+      *slot = n_classes++;
+    }
+    byte_class[b] = *slot;
+  }
+
+  return n_classes;
+}
+
+// split the bytes into classes that no step can tell apart. every step's set
+// refines the classes found so far.
+static void _byte_classes(REComp *r) {
+  memset(r->byte_class, 0, sizeof(r->byte_class));
+  r->n_classes = 1;
+
+  for (int i = 0; i < r->num_pairs; i++) {
+    r->n_classes = _byte_classes_split(r->byte_class, &r->steps[i].set);
+  }
+
+  if (r->has_multibyte) {
+    // a step's set holds its single-byte code points and its lead bytes, and
+    // only the lead bytes need a lookahead.
+    ByteSet high = {{0, 0, ~(uint64_t)0, ~(uint64_t)0}};
+    r->n_classes = _byte_classes_split(r->byte_class, &high);
+  }
+}
+
+uint16_t _dfa_lookahead(const REComp *r, int state, const char *p,
+                        const char *end) {
+  int t = _state_next_utf8(r, state, p, end);
+  if (t == STATE_DONE) {
+    return DFA_DONE;
+  }
+  if (t == STATE_DEAD) {
+    return DFA_DEAD;
+  }
+  return t;
+}
+
+void _dfa_build(REComp *r) {
+  r->dfa = NULL;
+  if (r->num_pairs == 0 || r->n_states > DFA_MAX_STATES) {
+    return;
+  }
+
+  _byte_classes(r);
+
+  // one representative byte per class to run _state_next with.
+  unsigned char rep[256];
+  for (int b = 255; b >= 0; b--) {
+    rep[r->byte_class[b]] = b;
+  }
+
+  r->dfa = malloc(sizeof(uint16_t) * r->n_states * r->n_classes);
+  for (int s = 0; s < r->n_states; s++) {
+    for (int c = 0; c < r->n_classes; c++) {
+      int t = _state_next(r, s, rep[c]);
+      uint16_t entry = t;
+      if (t == STATE_DONE) {
+        entry = DFA_DONE;
+      } else if (t == STATE_DEAD) {
+        entry = DFA_DEAD;
+      } else if (t == STATE_LOOKAHEAD) {
+        entry = DFA_LOOKAHEAD;
+      }
+      r->dfa[s * r->n_classes + c] = entry;
+    }
+  }
+}
+
+int _onepass_matches(const char *line, int line_len, const REComp *r,
+                     REScratch *scratch, Match *dest) {
+  // re_get_matches never starts a pattern on an empty line.
+  if (line_len == 0) {
+    return 0;
+  }
+
+  const uint16_t *dfa = r->dfa;
+  const unsigned char *byte_class = r->byte_class;
+  int n_classes = r->n_classes;
+
+  int state = 0;
+  for (int p = 0; p < line_len; p++) {
+    if (BUDGET_CHARGE(scratch, 1)) {
+      return RE_BUDGET_EXCEEDED;
+    }
+
+    uint16_t next = dfa[state * n_classes + byte_class[(unsigned char)line[p]]];
+    if (next == DFA_LOOKAHEAD) {
+      next = _dfa_lookahead(r, state, line + p, line + line_len);
+    }
+
+    if (next == DFA_DEAD) {
+      return 0;
+    }
+
+    if (next == DFA_DONE) {
+      if (r->has_dollar) {
+        return 0;
+      }
+      dest[0] = (Match){.start = 0, .end = p - 1};
+      return 1;
+    }
+
+    state = next;
+  }
+
+  if (!_state_accepts_at_end(r, state)) {
+    return 0;
+  }
+  dest[0] = (Match){.start = 0, .end = line_len - 1};
+  return 1;
+}
+
+// the same walk as above, but every time the thread crosses into a later step,
+// the steps it passed through start at this byte.
+int _onepass_spans(const char *line, int line_len, const REComp *r,
+                   Match *spans) {
+  if (line_len == 0) {
+    return 0;
+  }
+
+  const uint16_t *dfa = r->dfa;
+  const unsigned char *byte_class = r->byte_class;
+  int n_classes = r->n_classes;
+
+  int state = 0;
+  int step = 0;
+  int end = line_len - 1;
+  spans[0].start = 0;
+
+  for (int p = 0; p < line_len; p++) {
+    uint16_t next = dfa[state * n_classes + byte_class[(unsigned char)line[p]]];
+    if (next == DFA_LOOKAHEAD) {
+      next = _dfa_lookahead(r, state, line + p, line + line_len);
+    }
+
+    if (next == DFA_DEAD) {
+      return 0;
+    }
+
+    if (next == DFA_DONE) {
+      if (r->has_dollar) {
+        return 0;
+      }
+      for (step++; step < r->num_pairs; step++) {
+        spans[step].start = p;
+      }
+      end = p - 1;
+      goto matched;
+    }
+
+    int next_step = r->state_step[next];
+    for (step++; step <= next_step; step++) {
+      spans[step].start = p;
+    }
+    step = next_step;
+    state = next;
+  }
+
+  if (!_state_accepts_at_end(r, state)) {
+    return 0;
+  }
+
+matched : {
+  for (int i = 0; i < r->num_pairs - 1; i++) {
+    spans[i].end = spans[i + 1].start - 1;
+  }
+  spans[r->num_pairs - 1].end = end;
+  return 1;
+}
+}
+
+int re_extract(const char *line, const REComp *compiled, Match *spans) {
+  int line_len = strlen(line);
+
+  if (compiled->plan == PLAN_ONEPASS) {
+    return _onepass_spans(line, line_len, compiled, spans);
+  }
+
+  // otherwise, find the first start that matches.
+  int up_to = compiled->has_caret ? 1 : line_len;
+  for (int c = 0; c < up_to; c++) {
+    if (_interp_spans(line, line_len, compiled, c, spans)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
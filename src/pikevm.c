@@ -0,0 +1,161 @@
+#include "engine.h"
+#include "libregex.h"
+#include <string.h>
+
+// runs every start through the pattern at the same time, in one forward pass
+// over the line. a thread is a start position plus the state it's in. since
+// _pair never backtracks, two threads in the same state at the same position
+// are going to end in exactly the same place, so they get merged into one
+// group per state. that bounds the work per byte by the number of states,
+// where the interpreter would redo the whole tail for each start.
+//
+// the starts in a group are a linked list threaded through next_start, so
+// merging two groups is just a splice. all of this lives in the caller's
+// scratch.
+
+#define NO_MATCH -2
+// end_of for a position the prefilter jumped over, where next_start holds the
+// position it jumped to. end_of is only ever filled in for the positions the
+// pass gets to, so a line with few starts doesn't cost a write per byte.
+#define SKIPPED -3
+
+void _group_push(Groups *g, int *next_start, int state, int first, int last) {
+  if (g->head[state] < 0) {
+    g->head[state] = first;
+    g->live[g->num_live++] = state;
+  } else {
+    next_start[g->tail[state]] = first;
+  }
+  g->tail[state] = last;
+}
+
+void _groups_clear(Groups *g) {
+  for (int i = 0; i < g->num_live; i++) {
+    g->head[g->live[i]] = -1;
+  }
+  g->num_live = 0;
+}
+
+int _pikevm_matches(const char *line, int line_len, const REComp *r,
+                    REScratch *scratch, Match *dest) {
+  _scratch_reserve(scratch, r->n_states, line_len);
+
+  int cap = scratch->state_cap;
+  int *groups = scratch->groups;
+  Groups a = {.head = groups, .tail = groups + cap, .live = groups + 2 * cap};
+  Groups b = {.head = groups + 3 * cap, .tail = groups + 4 * cap,
+              .live = groups + 5 * cap};
+  int *next_start = scratch->positions;
+  int *end_of = next_start + scratch->line_cap;
+
+  // one past the last start pushed.
+  int starts_end = 0;
+
+  Groups *cur = &a;
+  Groups *next = &b;
+
+  const char *end = line + line_len;
+  for (int p = 0; p < line_len; p++) {
+    if (!r->has_caret || p == 0) {
+      if (cur->num_live == 0 && r->prefilter != PREFILTER_NONE) {
+        // nothing is in flight, so jump straight to the next possible start.
+        const char *skip = line + p;
+        int found = _prefilter_advance(r, &skip, end, scratch);
+        if (found == RE_BUDGET_EXCEEDED) {
+          return RE_BUDGET_EXCEEDED;
+        }
+        if (!found) {
+          break;
+        }
+        if (skip > line + p) {
+          end_of[p] = SKIPPED;
+          next_start[p] = skip - line;
+          p = skip - line;
+        }
+      }
+
+      next_start[p] = -1;
+      end_of[p] = NO_MATCH;
+      starts_end = p + 1;
+      _group_push(cur, next_start, 0, p, p);
+    } else if (cur->num_live == 0) {
+      break;
+    }
+
+    if (BUDGET_CHARGE(scratch, cur->num_live)) {
+      _groups_clear(cur);
+      return RE_BUDGET_EXCEEDED;
+    }
+
+    unsigned char byte = line[p];
+    for (int i = 0; i < cur->num_live; i++) {
+      int s = cur->live[i];
+      int first = cur->head[s];
+      cur->head[s] = -1;
+
+      int t;
+      if (r->dfa) {
+        uint16_t entry = r->dfa[s * r->n_classes + r->byte_class[byte]];
+        t = (entry == DFA_DONE)        ? STATE_DONE
+            : (entry == DFA_DEAD)      ? STATE_DEAD
+            : (entry == DFA_LOOKAHEAD) ? STATE_LOOKAHEAD
+                                       : entry;
+      } else {
+        t = _state_next(r, s, byte);
+      }
+      if (t == STATE_LOOKAHEAD) {
+        t = _state_next_utf8(r, s, line + p, end);
+      }
+
+      if (t >= 0) {
+        _group_push(next, next_start, t, first, cur->tail[s]);
+      } else if (t == STATE_DONE && !r->has_dollar) {
+        // the match ended on the byte before this one.
+        if (scratch->first_only) {
+          // any start will do.
+          _groups_clear(cur);
+          _groups_clear(next);
+          dest[0] = (Match){.start = first, .end = p - 1};
+          return 1;
+        }
+        for (int c = first; c >= 0; c = next_start[c]) {
+          end_of[c] = p - 1;
+        }
+      }
+    }
+    cur->num_live = 0;
+
+    Groups *tmp = cur;
+    cur = next;
+    next = tmp;
+  }
+
+  // whatever is still running got to the end of the line.
+  for (int i = 0; i < cur->num_live; i++) {
+    int s = cur->live[i];
+    if (_state_accepts_at_end(r, s)) {
+      for (int c = cur->head[s]; c >= 0; c = next_start[c]) {
+        end_of[c] = line_len - 1;
+      }
+    }
+    // leave the heads empty for the next call.
+    cur->head[s] = -1;
+  }
+
+  int num_matches = 0;
+  for (int c = 0; c < starts_end; c++) {
+    if (end_of[c] == SKIPPED) {
+      c = next_start[c] - 1;
+      continue;
+    }
+    if (end_of[c] != NO_MATCH) {
+      dest[num_matches] = (Match){.start = c, .end = end_of[c]};
+      num_matches++;
+      if (scratch->first_only) {
+        break;
+      }
+    }
+  }
+
+  return num_matches;
+}
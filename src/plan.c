@@ -0,0 +1,445 @@
+#include "engine.h"
+#include "libregex.h"
+#include "macros.h"
+#include <stdio.h>
+#include <string.h>
+
+// if the first step's set has more bytes than this, skipping to the next
+// member isn't worth it over just running the engine.
+#define BYTESET_PREFILTER_MAX 64
+
+static void _byteset_add(ByteSet *set, unsigned char b) {
+  set->bits[b >> 6] |= (uint64_t)1 << (b & 63);
+}
+
+static int _byteset_count(const ByteSet *set) {
+  int count = 0;
+  for (int i = 0; i < 4; i++) {
+    count += __builtin_popcountll(set->bits[i]);
+  }
+  return count;
+}
+
+// the lowest byte in the set. only meaningful on a non-empty set.
+static unsigned char _byteset_first(const ByteSet *set) {
+  for (int i = 0; i < 4; i++) {
+    if (set->bits[i]) {
+      return i * 64 + __builtin_ctzll(set->bits[i]);
+    }
+  }
+  return 0;
+}
+
+// whether the pair can eat more than one byte at a time. a thread can't tell
+// from the lead byte alone whether those eat a code point, since it would have
+// to give the lead byte back when the rest doesn't match, so they look ahead.
+static int _is_multibyte(const Pair *p) {
+  if (p->obj.type != OBJ_UTF8_CLASS) {
+    return 0;
+  }
+
+  const Utf8Class *c = &p->obj.data.utf8;
+  for (int i = 0; i < c->num_seqs; i++) {
+    if (c->seqs[i].len > 1) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// if the pair only ever matches one exact string of bytes, write it to out and
+// return its length. otherwise, return 0.
+static int _pair_literal(const Pair *p, const Step *step, char *out) {
+  if (step->min != 1 || step->max != 1) {
+    return 0;
+  }
+
+  if (_is_multibyte(p)) {
+    const Utf8Class *c = &p->obj.data.utf8;
+    if (c->num_seqs != 1 || memcmp(c->seqs[0].lo, c->seqs[0].hi, 4) != 0) {
+      return 0;
+    }
+    memcpy(out, c->seqs[0].lo, c->seqs[0].len);
+    return c->seqs[0].len;
+  }
+
+  if (_byteset_count(&step->set) != 1) {
+    return 0;
+  }
+  out[0] = _byteset_first(&step->set);
+  return 1;
+}
+
+// turn a parsed pair into a step. the repetition ranges here follow exactly
+// what _pair does with each modifier, including the degenerate ranges that
+// the parser can produce.
+static void _lower_pair(const Pair *p, Step *step) {
+  memset(&step->set, 0, sizeof(ByteSet));
+  for (int b = 1; b < 256; b++) {
+    if (_obj_accepts(&p->obj, (char)b)) {
+      _byteset_add(&step->set, b);
+    }
+  }
+
+  if (_is_multibyte(p)) {
+    // the set can't describe the step, but every match of it still has to
+    // begin with one of the lead bytes. that's all the prefilter needs, and
+    // it's where _state_next hands the rest of the code point off to
+    // _state_next_utf8.
+    const Utf8Class *c = &p->obj.data.utf8;
+    for (int i = 0; i < c->num_seqs; i++) {
+      for (int b = c->seqs[i].lo[0]; b <= c->seqs[i].hi[0]; b++) {
+        _byteset_add(&step->set, b);
+      }
+    }
+  }
+
+  Mod m = p->mod;
+  switch (m.type) {
+  case MOD_QUESTION: {
+    step->min = 0;
+    step->max = 1;
+  } break;
+  case MOD_STAR: {
+    step->min = 0;
+    step->max = -1;
+  } break;
+  case MOD_PLUS: {
+    step->min = 1;
+    step->max = -1;
+  } break;
+  case MOD_N_M: {
+    step->min = MAX(m.range_data.n_m.n, 0);
+    step->max = MAX(m.range_data.n_m.m, 0);
+  } break;
+  case MOD_N_: {
+    step->min = MAX(m.range_data.n, 0);
+    step->max = -1;
+  } break;
+  case MOD_N: {
+    step->min = MAX(m.range_data.n, 0);
+    step->max = step->min;
+  } break;
+  case MOD_NONE:
+  default: {
+    step->min = 1;
+    step->max = 1;
+  } break;
+  }
+}
+
+// how many distinct repetition counts a thread can be at inside of the step.
+// unbounded steps stop counting once the minimum is reached.
+static int _step_width(const Step *step) {
+  return ((step->max < 0) ? step->min : step->max) + 1;
+}
+
+void _plan(REComp *r) {
+  int all_literal = 1;
+  int all_fixed = 1;
+  int any_multibyte = 0;
+  int fixed_len = 0;
+
+  r->n_states = 0;
+  r->literal_len = 0;
+  for (int i = 0; i < r->num_pairs; i++) {
+    Step *step = &r->steps[i];
+    _lower_pair(&r->pairs[i], step);
+
+    if (_is_multibyte(&r->pairs[i])) {
+      any_multibyte = 1;
+    }
+
+    if (all_literal) {
+      int len = _pair_literal(&r->pairs[i], step, &r->literal[r->literal_len]);
+      r->literal_len += len;
+      all_literal = len > 0;
+    }
+    if (step->min != step->max || step->min == 0) {
+      all_fixed = 0;
+    }
+    fixed_len += step->min;
+
+    r->step_base[i] = r->n_states;
+    r->n_states += _step_width(step);
+  }
+  r->step_base[r->num_pairs] = r->n_states;
+
+  // every state gets three more, for passing over the rest of a code point
+  // on the way into it.
+  r->has_multibyte = any_multibyte;
+  if (any_multibyte) {
+    r->n_states *= 4;
+  }
+
+  if (r->num_pairs == 0) {
+    r->plan = PLAN_INTERP;
+  } else if (all_literal) {
+    r->plan = PLAN_LITERAL;
+  } else if (all_fixed && !any_multibyte && fixed_len <= 64) {
+    r->plan = PLAN_SHIFT_AND;
+  } else if (r->has_caret) {
+    // with a caret there's only the one start, so it's a single walk through
+    // the table when the pattern is small enough to have one.
+    r->plan = (r->n_states <= DFA_MAX_STATES) ? PLAN_ONEPASS : PLAN_INTERP;
+  } else if (r->n_states > MAX_STATES) {
+    r->plan = PLAN_INTERP;
+  } else {
+    r->plan = PLAN_PIKEVM;
+  }
+
+  switch (r->plan) {
+  case PLAN_SHIFT_AND: {
+    memset(r->shift_masks, 0, sizeof(r->shift_masks));
+    int j = 0;
+    for (int i = 0; i < r->num_pairs; i++) {
+      Step *step = &r->steps[i];
+      for (int rep = 0; rep < step->min; rep++, j++) {
+        for (int b = 0; b < 256; b++) {
+          if (BYTESET_HAS(&step->set, b)) {
+            r->shift_masks[b] |= (uint64_t)1 << j;
+          }
+        }
+      }
+    }
+    r->shift_len = fixed_len;
+  } break;
+
+  default: {
+  } break;
+  }
+
+  if (r->n_states <= MAX_STATES) {
+    for (int i = 0; i < r->num_pairs; i++) {
+      for (int s = r->step_base[i]; s < r->step_base[i + 1]; s++) {
+        r->state_step[s] = i;
+      }
+    }
+    // a thread passing over a code point is already in the step it's going
+    // to.
+    int skip_base = r->step_base[r->num_pairs];
+    for (int s = skip_base; s < r->n_states; s++) {
+      r->state_step[s] = r->state_step[(s - skip_base) / 3];
+    }
+  }
+
+  if (r->plan == PLAN_ONEPASS || r->plan == PLAN_PIKEVM) {
+    _dfa_build(r);
+  }
+
+  // a prefilter only pays off when there are many starts to throw away, and
+  // only works when the first step can't be skipped.
+  r->prefilter = PREFILTER_NONE;
+  if (r->plan != PLAN_LITERAL && !r->has_caret && r->num_pairs > 0 &&
+      r->steps[0].min > 0) {
+    int count = _byteset_count(&r->steps[0].set);
+    if (count == 1) {
+      r->prefilter = PREFILTER_MEMCHR;
+      r->first_byte = _byteset_first(&r->steps[0].set);
+    } else if (count <= BYTESET_PREFILTER_MAX) {
+      r->prefilter = PREFILTER_BYTESET;
+    }
+  }
+}
+
+// the position of the next byte in [from, end) that could start a match, or
+// NULL if there isn't one.
+const char *_prefilter_skip(const REComp *r, const char *from,
+                            const char *end) {
+  switch (r->prefilter) {
+  case PREFILTER_MEMCHR: {
+    return memchr(from, r->first_byte, end - from);
+  } break;
+
+  case PREFILTER_BYTESET: {
+    const ByteSet *set = &r->steps[0].set;
+    for (; from < end; from++) {
+      if (BYTESET_HAS(set, *from)) {
+        return from;
+      }
+    }
+    return NULL;
+  } break;
+
+  default: {
+    return (from < end) ? from : NULL;
+  } break;
+  }
+}
+
+// move *from on to the next byte that could start a match, charging the
+// scratch for the bytes passed over. the skip goes a stretch at a time so a
+// deadline still gets checked on a long run of bytes that can't start one.
+// returns 1, 0 if there's nothing left, or RE_BUDGET_EXCEEDED.
+int _prefilter_advance(const REComp *r, const char **from, const char *end,
+                       REScratch *scratch) {
+  const char *p = *from;
+  while (p < end) {
+    const char *stretch_end =
+        (end - p > RE_BUDGET_INTERVAL) ? p + RE_BUDGET_INTERVAL : end;
+    const char *hit = _prefilter_skip(r, p, stretch_end);
+    if (BUDGET_CHARGE(scratch, (hit ? hit : stretch_end) - p)) {
+      return RE_BUDGET_EXCEEDED;
+    }
+    if (hit != NULL) {
+      *from = hit;
+      return 1;
+    }
+    p = stretch_end;
+  }
+  return 0;
+}
+
+// a thread partway through a code point takes the next byte whatever it is,
+// since the lookahead already checked it.
+static int _skip_next(const REComp *r, int state) {
+  int skip = state - r->step_base[r->num_pairs];
+  return (skip % 3 == 0) ? skip / 3 : state - 1;
+}
+
+// feed one byte to a thread. a thread in a step first tries to eat the byte
+// there, and only moves on to the next step when it can't, since _pair never
+// gives anything back.
+int _state_next(const REComp *r, int state, unsigned char b) {
+  if (state >= r->step_base[r->num_pairs]) {
+    return _skip_next(r, state);
+  }
+
+  int i = r->state_step[state];
+  int k = state - r->step_base[i];
+
+  for (;;) {
+    const Step *step = &r->steps[i];
+
+    if ((step->max < 0 || k < step->max) && BYTESET_HAS(&step->set, b)) {
+      if (b >= 0x80 && r->pairs[i].obj.type == OBJ_UTF8_CLASS) {
+        // a lead byte, and only the rest of its code point can say whether
+        // the step eats it.
+        return STATE_LOOKAHEAD;
+      }
+      if (step->max >= 0 || k < step->min) {
+        k++;
+      }
+      return r->step_base[i] + k;
+    }
+
+    if (k < step->min) {
+      return STATE_DEAD;
+    }
+
+    i++;
+    k = 0;
+    if (i == r->num_pairs) {
+      return STATE_DONE;
+    }
+  }
+}
+
+// how many bytes at p step i eats as one repetition, or 0 if it doesn't.
+static int _step_eat_len(const REComp *r, int i, const char *p,
+                         const char *end) {
+  if (r->pairs[i].obj.type == OBJ_UTF8_CLASS) {
+    return _utf8_eat_len(&r->pairs[i].obj.data.utf8, p, end);
+  }
+  return BYTESET_HAS(&r->steps[i].set, *p);
+}
+
+// the same walk as _state_next, but each step takes the whole code point at p
+// or none of it. a multibyte code point leaves the thread in one of the states
+// that pass over the rest of it, so everything after the lead byte stays a
+// plain byte transition.
+int _state_next_utf8(const REComp *r, int state, const char *p,
+                     const char *end) {
+  int i = r->state_step[state];
+  int k = state - r->step_base[i];
+
+  for (;;) {
+    const Step *step = &r->steps[i];
+
+    int len = (step->max < 0 || k < step->max) ? _step_eat_len(r, i, p, end)
+                                               : 0;
+    if (len > 0) {
+      if (step->max >= 0 || k < step->min) {
+        k++;
+      }
+      int t = r->step_base[i] + k;
+      return (len == 1) ? t : r->step_base[r->num_pairs] + 3 * t + len - 2;
+    }
+
+    if (k < step->min) {
+      return STATE_DEAD;
+    }
+
+    i++;
+    k = 0;
+    if (i == r->num_pairs) {
+      return STATE_DONE;
+    }
+  }
+}
+
+// whether a thread that runs out of line in this state is a match. only the
+// last step can be in progress at the end, since re_get_matches won't start a
+// pair past the end of the line. a thread can't be partway through a code
+// point there either, since the lookahead only takes whole ones.
+int _state_accepts_at_end(const REComp *r, int state) {
+  if (state >= r->step_base[r->num_pairs]) {
+    return 0;
+  }
+  int i = r->state_step[state];
+  int k = state - r->step_base[i];
+  return i == r->num_pairs - 1 && k >= r->steps[i].min;
+}
+
+int _exec(const char *line, int line_len, const REComp *r,
+          REScratch *scratch, Match *dest) {
+  switch (r->plan) {
+  case PLAN_LITERAL:
+    return _literal_matches(line, line_len, r, scratch, dest);
+  case PLAN_SHIFT_AND:
+    return _shift_and_matches(line, line_len, r, scratch, dest);
+  case PLAN_PIKEVM:
+    return _pikevm_matches(line, line_len, r, scratch, dest);
+  case PLAN_ONEPASS:
+    return _onepass_matches(line, line_len, r, scratch, dest);
+  case PLAN_INTERP:
+  default:
+    return _interp_matches(line, line_len, r, scratch, dest);
+  }
+}
+
+REPlan re_get_plan(const REComp *compiled) { return compiled->plan; }
+
+REPrefilter re_get_prefilter(const REComp *compiled) {
+  return compiled->prefilter;
+}
+
+const char *re_plan_name(REPlan plan) {
+  switch (plan) {
+  case PLAN_INTERP:
+    return "interp";
+  case PLAN_LITERAL:
+    return "literal";
+  case PLAN_SHIFT_AND:
+    return "shift-and";
+  case PLAN_PIKEVM:
+    return "pikevm";
+  case PLAN_ONEPASS:
+    return "onepass";
+  default:
+    return "unknown";
+  }
+}
+
+const char *re_prefilter_name(REPrefilter prefilter) {
+  switch (prefilter) {
+  case PREFILTER_NONE:
+    return "none";
+  case PREFILTER_MEMCHR:
+    return "memchr";
+  case PREFILTER_BYTESET:
+    return "byteset";
+  default:
+    return "unknown";
+  }
+}
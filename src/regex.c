@@ -1,3 +1,4 @@
+#include "engine.h"
 #include "libregex.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,18 +17,24 @@
 // we can't have the caller allocate all the recursive REComps ahead of time,
 // that would be over-complicated. just calloc each REComp as we make it.
 REComp *re_compile(const char *pattern_static) {
+  return re_compile_flags(pattern_static, 0);
+}
+
+REComp *re_compile_flags(const char *pattern_static, int flags) {
   REComp *dest = calloc(1, sizeof(REComp));
+  dest->flags = flags;
+  int utf8 = flags & RE_UTF8;
 
   // make a copy so that we don't segfault modifying a potentially static .data
   // string.
   int len = strlen(pattern_static);
-  char pattern_copied[len];
-  memcpy(pattern_copied, pattern_static, len);
+  char pattern_copied[len + 1];
+  memcpy(pattern_copied, pattern_static, len + 1);
   char *pattern = pattern_copied;
 
   // handle the opening and closing ^ and $.
   dest->has_caret = (pattern[0] == '^');
-  dest->has_dollar = (pattern[len - 1] == '$');
+  dest->has_dollar = (len > 0 && pattern[len - 1] == '$');
 
   // ignore these characters in the compilation if they're in the regex pattern.
   if (dest->has_dollar) {
@@ -57,13 +64,31 @@ REComp *re_compile(const char *pattern_static) {
       // escaped metacharacter (or normal character).
     case '\\': {
       NEXT_CHAR();
-      o.type = OBJ_CHAR;
-      o.data.ch = pat_ch;
-      NEXT_CHAR();
+      if (utf8 && pat_ch == 'p' && pattern[idx + 1] == '{') {
+        // \p{L}, a unicode property.
+        idx++;
+        o.type = OBJ_UTF8_CLASS;
+        o.data.utf8 = _utf8_property(pattern, &idx);
+        pat_ch = pattern[idx];
+      } else if (utf8 && (unsigned char)pat_ch >= 0x80) {
+        o.type = OBJ_UTF8_CLASS;
+        o.data.utf8 = _utf8_code_point(pattern, &idx);
+        pat_ch = pattern[idx];
+      } else {
+        o.type = OBJ_CHAR;
+        o.data.ch = pat_ch;
+        NEXT_CHAR();
+      }
     } break;
 
     case '.': {
-      o.type = OBJ_DOT;
+      if (utf8) {
+        // a whole code point, not just a byte of one.
+        o.type = OBJ_UTF8_CLASS;
+        o.data.utf8 = _utf8_dot();
+      } else {
+        o.type = OBJ_DOT;
+      }
       NEXT_CHAR();
     } break;
 
@@ -84,10 +109,18 @@ REComp *re_compile(const char *pattern_static) {
 
       subobj_buf[so_len] = '\0';
 
-      o.data.sub_regex = re_compile(subobj_buf);
+      o.data.sub_regex = re_compile_flags(subobj_buf, flags);
     } break;
 
     case '[': {
+      if (utf8) {
+        NEXT_CHAR();
+        o.type = OBJ_UTF8_CLASS;
+        o.data.utf8 = _utf8_class(pattern, &idx);
+        pat_ch = pattern[idx];
+        break;
+      }
+
       Class c = {0};
 
       // some sort of class.
@@ -114,14 +147,21 @@ REComp *re_compile(const char *pattern_static) {
         _class++; // discard the '^' after we've acknowledged it.
       }
 
-      char *range_buf = calloc(sizeof(char), 16);
+      // at worst every character in the class is its own range.
+      char *range_buf = calloc(sizeof(char), 2 * cb_len + 2);
 
       int i = 0;
 
       while (_class[0] != '\0') {
         char start = _class[0];
-        char end = _class[2];
-        _class += 3;
+        char end = start;
+        if (_class[1] == '-' && _class[2] != '\0') {
+          end = _class[2];
+          _class += 3;
+        } else {
+          // a lone character is just a range of one.
+          _class++;
+        }
 
         range_buf[i] = start;
         range_buf[i + 1] = end;
@@ -136,6 +176,14 @@ REComp *re_compile(const char *pattern_static) {
     } break;
 
     default: {
+      if (utf8 && (unsigned char)pat_ch >= 0x80) {
+        // a multibyte character, so the modifier applies to all of it.
+        o.type = OBJ_UTF8_CLASS;
+        o.data.utf8 = _utf8_code_point(pattern, &idx);
+        pat_ch = pattern[idx];
+        break;
+      }
+
       // normal ascii character, gets generated into a simple char object.
       o.type = OBJ_CHAR;
       o.data.ch = pat_ch;
@@ -225,94 +273,103 @@ REComp *re_compile(const char *pattern_static) {
 
 #undef NEXT_CHAR
 
+  // now that the pairs are all there, pick how this pattern should run.
+  _plan(dest);
+
   return dest;
 }
 
-const char *_eat(Obj *o, const char *line) {
-  if (line == NULL)
-    return NULL;
-
-  char to_match = line[0];
-
+int _obj_accepts(const Obj *o, char to_match) {
   // automatically fail on a NULL.
   if (to_match == '\0')
-    return NULL;
+    return 0;
 
   switch (o->type) {
   case OBJ_CHAR: {
-    if (o->data.ch == to_match) {
-      return line + 1;
-    } else {
-      return NULL;
-    }
+    return o->data.ch == to_match;
   } break;
 
   case OBJ_DOT: {
     // matches with everything except for a newline.
-    if (to_match != '\n') {
-      return line + 1;
-    } else {
-      return NULL;
-    }
+    return to_match != '\n';
   } break;
 
   case OBJ_CLASS: {
-    if (o->data.class.is_generic) {
+    int in_class = 0;
 
+    if (o->data.class.is_generic) {
       // if we're using a function class matcher, then try to match the to_match
       // using that.
       class_match_fn fn = o->data.class.fn;
-
-      if (fn) {
-        if (fn(to_match)) {
-          return line + 1;
-        } else {
-          return NULL;
-        }
-      } else {
-        return NULL;
-      }
-
+      in_class = fn && fn(to_match);
     } else {
       char *ranges = o->data.class.range_data.ranges;
       // else, use the ranges like usual.
       for (int i = 0; i < o->data.class.range_data.num_points; i += 2) {
         // make it inclusive on the right.
         if (IS_BETWEEN(to_match, ranges[i], ranges[i + 1] + 1)) {
-          return line + 1;
+          in_class = 1;
+          break;
         }
       }
-
-      // if nothing matched, return NULL.
-      return NULL;
     }
 
+    // [^...] flips the result.
+    return in_class != o->data.class.is_complement;
+  } break;
+
+  case OBJ_UTF8_CLASS: {
+    // only the code points that are a single byte.
+    for (int i = 0; i < o->data.utf8.num_seqs; i++) {
+      const Utf8Seq *seq = &o->data.utf8.seqs[i];
+      if (seq->len == 1 && (unsigned char)to_match >= seq->lo[0] &&
+          (unsigned char)to_match <= seq->hi[0]) {
+        return 1;
+      }
+    }
+    return 0;
   } break;
 
   case OBJ_SUBREGEX: {
     // ?? we don't have the parent's matches.
     // re_get_matches(line, o->data.sub_regex, );
-    return NULL;
+    return 0;
   } break;
 
   default: {
-    return NULL;
+    return 0;
   } break;
   }
 }
 
+const char *_eat(const Obj *o, const char *line, const char *end) {
+  if (line == NULL || line >= end)
+    return NULL;
+
+  if (o->type == OBJ_UTF8_CLASS) {
+    int len = _utf8_eat_len(&o->data.utf8, line, end);
+    return len ? line + len : NULL;
+  }
+
+  if (_obj_accepts(o, line[0])) {
+    return line + 1;
+  } else {
+    return NULL;
+  }
+}
+
 // take in the point in the line, either return the new pointer to the line
 // position after the successful match, or NULL for an unsuccessful match.
-const char *_pair(Pair *p, const char *line) {
+const char *_pair(const Pair *p, const char *line, const char *end) {
   Mod m = p->mod;
   switch (m.type) {
   case MOD_NONE: {
-    return _eat(&p->obj, line);
+    return _eat(&p->obj, line, end);
   } break;
 
   case MOD_N: {
     for (int i = 0; i < m.range_data.n; i++) {
-      line = _eat(&p->obj, line);
+      line = _eat(&p->obj, line, end);
     }
 
     return line;
@@ -322,7 +379,7 @@ const char *_pair(Pair *p, const char *line) {
     // just n_m without the limit that it stops when we reach the upper bound.
     int num_eaten = 0;
     for (;;) {
-      const char *after = _eat(&p->obj, line);
+      const char *after = _eat(&p->obj, line, end);
       if (after) {
         line = after;
       } else {
@@ -350,7 +407,7 @@ const char *_pair(Pair *p, const char *line) {
         break;
       }
 
-      const char *after = _eat(&p->obj, line);
+      const char *after = _eat(&p->obj, line, end);
       if (after) {
         line = after;
       } else {
@@ -369,7 +426,7 @@ const char *_pair(Pair *p, const char *line) {
 
   case MOD_PLUS: {
     // assert that there must be at least one match.
-    const char *after = _eat(&p->obj, line);
+    const char *after = _eat(&p->obj, line, end);
     if (!after) {
       return NULL;
     } else {
@@ -377,7 +434,7 @@ const char *_pair(Pair *p, const char *line) {
     }
 
     for (;;) {
-      after = _eat(&p->obj, line);
+      after = _eat(&p->obj, line, end);
       if (after) {
         line = after;
       } else {
@@ -390,7 +447,7 @@ const char *_pair(Pair *p, const char *line) {
 
   case MOD_STAR: {
     for (;;) { // _eat until we hit a NULL, then we're done.
-      const char *after = _eat(&p->obj, line);
+      const char *after = _eat(&p->obj, line, end);
       if (after) {
         line = after;
       } else {
@@ -403,7 +460,7 @@ const char *_pair(Pair *p, const char *line) {
 
   case MOD_QUESTION: {
     // try _eat, if it works that's good, if it doesn't that's fine too.
-    const char *after = _eat(&p->obj, line);
+    const char *after = _eat(&p->obj, line, end);
     if (after) {
       line = after;
     }
@@ -417,12 +474,11 @@ const char *_pair(Pair *p, const char *line) {
   }
 }
 
-int re_get_matches(const char *line, REComp *compiled, Match *dest) {
-  int line_len = strlen(line);
+int _interp_matches(const char *line, int line_len, const REComp *compiled,
+                    REScratch *scratch, Match *dest) {
   int num_matches = 0;
 
   Match m;
-  m.start = 0; // init by trying to match with the first possible character.
 
   int up_to = line_len;
   if (compiled->has_caret) {
@@ -430,19 +486,41 @@ int re_get_matches(const char *line, REComp *compiled, Match *dest) {
     up_to = 1;
   }
 
+  const char *end = line + line_len;
+
   // try to match starting with each character in the string.
   for (int c = 0; c < up_to; c++) {
+    if (compiled->prefilter != PREFILTER_NONE) {
+      // starts that can't get past the first pair are skipped over in bulk.
+      const char *next = &line[c];
+      int found = _prefilter_advance(compiled, &next, end, scratch);
+      if (found == RE_BUDGET_EXCEEDED) {
+        return RE_BUDGET_EXCEEDED;
+      }
+      if (!found) {
+        break;
+      }
+      c = next - line;
+    }
+
+    m.start = c;
     const char *_line = &line[c];
 
     for (int i = 0; i < compiled->num_pairs; i++) {
-      if (_line >= line + line_len) {
+      if (_line >= end) {
         // we've run out of space to keep matching in the pattern. this is not a
         // match.
         goto fail;
       }
 
-      Pair *p = &compiled->pairs[i];
-      _line = _pair(p, _line);
+      const Pair *p = &compiled->pairs[i];
+      const char *before = _line;
+      _line = _pair(p, _line, end);
+
+      // the bytes the pair ate, plus the one that stopped it.
+      if (BUDGET_CHARGE(scratch, (_line ? _line - before : 0) + 1)) {
+        return RE_BUDGET_EXCEEDED;
+      }
 
       if (_line == NULL) {
         goto fail;
@@ -452,7 +530,6 @@ int re_get_matches(const char *line, REComp *compiled, Match *dest) {
     goto succeed;
 
   fail : {
-    m.start = c + 1;
     continue;
   }
 
@@ -465,35 +542,68 @@ int re_get_matches(const char *line, REComp *compiled, Match *dest) {
     }
     memcpy(&dest[num_matches], &m, sizeof(Match));
     num_matches++;
-    // the next index we're going through on the next attempted match.
-    m.start = c + 1;
+    if (scratch->first_only) {
+      break;
+    }
     continue;
   }
   }
 
-full_break : {}
-
-  // this is kind of a hack, but we can filter out any matches after the fact
-  // that don't line up with the $ expectation.
-  if (compiled->has_dollar) {
-    Match buf[16];
-    int buf_len = 0;
-    for (int i = 0; i < num_matches; i++) {
-      Match *m = &dest[i];
-      if (m->end == line_len - 1) {
-        memcpy(&buf[buf_len], m, sizeof(Match));
-        buf_len++;
-      }
+  return num_matches;
+}
+
+int _interp_spans(const char *line, int line_len, const REComp *r, int start,
+                  Match *spans) {
+  const char *end = line + line_len;
+  const char *_line = &line[start];
+
+  for (int i = 0; i < r->num_pairs; i++) {
+    if (_line >= end) {
+      return 0;
     }
 
-    // then, copy in the temp filter match list into the real Match *dest one.
-    num_matches = buf_len;
-    memcpy(dest, buf, sizeof(Match) * buf_len);
+    spans[i].start = _line - line;
+    _line = _pair(&r->pairs[i], _line, end);
+
+    if (_line == NULL) {
+      return 0;
+    }
+    spans[i].end = _line - line - 1;
+  }
+
+  // same as re_get_matches, the match has to end at the end of the line.
+  if (r->has_dollar && _line != end) {
+    return 0;
   }
 
+  return 1;
+}
+
+int re_get_matches(const char *line, const REComp *compiled, Match *dest) {
+  REScratch scratch = {0};
+  int num_matches =
+      re_get_matches_scratch(line, strlen(line), compiled, &scratch, dest);
+  free(scratch.groups);
+  free(scratch.positions);
   return num_matches;
 }
 
+int re_get_matches_scratch(const char *line, int line_len,
+                           const REComp *compiled, REScratch *scratch,
+                           Match *dest) {
+  _budget_start(scratch);
+  scratch->first_only = 0;
+  return _exec(line, line_len, compiled, scratch, dest);
+}
+
+int re_is_match(const char *line, int line_len, const REComp *compiled,
+                REScratch *scratch) {
+  Match m;
+  _budget_start(scratch);
+  scratch->first_only = 1;
+  return _exec(line, line_len, compiled, scratch, &m);
+}
+
 void re_debug_print(REComp *recomp) {
   if (!recomp) {
     printf("REComp is NULL!\n");
@@ -503,6 +613,9 @@ void re_debug_print(REComp *recomp) {
   printf("REComp Debug Print Start:\n");
   printf("\tHas dollar: %d\n\tHas caret: %d\n", recomp->has_dollar,
          recomp->has_caret);
+  printf("\tUTF-8: %d\n", (recomp->flags & RE_UTF8) != 0);
+  printf("\tPlan: %s\n\tPrefilter: %s\n", re_plan_name(recomp->plan),
+         re_prefilter_name(recomp->prefilter));
 
   for (int i = 0; i < recomp->num_pairs; i++) {
     Pair p = recomp->pairs[i];
@@ -521,6 +634,9 @@ void re_debug_print(REComp *recomp) {
     case OBJ_CLASS:
       printf("OBJ_CLASS\n");
       break;
+    case OBJ_UTF8_CLASS:
+      printf("OBJ_UTF8_CLASS\n");
+      break;
     case OBJ_COUNT:
       printf("OBJ_COUNT\n");
       break;
@@ -577,6 +693,18 @@ void re_debug_print(REComp *recomp) {
       }
     }
 
+    if (p.obj.type == OBJ_UTF8_CLASS) {
+      printf("  Utf8 Sequences: %d\n", p.obj.data.utf8.num_seqs);
+      for (int k = 0; k < p.obj.data.utf8.num_seqs; k++) {
+        Utf8Seq *seq = &p.obj.data.utf8.seqs[k];
+        printf("     ");
+        for (int j = 0; j < seq->len; j++) {
+          printf(" [%02x-%02x]", seq->lo[j], seq->hi[j]);
+        }
+        printf("\n");
+      }
+    }
+
     printf("\n");
   }
 
@@ -588,8 +716,14 @@ void re_free(REComp *r) {
     Pair *p = &r->pairs[i];
     if (p->obj.type == OBJ_SUBREGEX) {
       re_free(p->obj.data.sub_regex);
+    } else if (p->obj.type == OBJ_CLASS && !p->obj.data.class.is_generic) {
+      free(p->obj.data.class.range_data.ranges);
+    } else if (p->obj.type == OBJ_UTF8_CLASS) {
+      free(p->obj.data.utf8.seqs);
+      free(p->obj.data.utf8.lead_index);
     }
   }
 
+  free(r->dfa);
   free(r);
 }
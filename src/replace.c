@@ -0,0 +1,169 @@
+#include "engine.h"
+#include "libregex.h"
+#include <string.h>
+
+// replacing runs on top of re_scan_lines, so the input is never split into
+// lines and the stretches between matches go out in one write each. of the
+// matches from every start, a match is only replaced when it starts after the
+// last one replaced, which leaves the leftmost non-overlapping ones.
+
+typedef struct Replacer {
+  const REComp *r;
+  const char *replacement;
+  int needs_spans; // whether the template has a $N, so spans are worth finding.
+  re_write_fn write;
+  void *ctx;
+
+  const char *buf;
+  const char *copied_to;    // the input before here has been written out.
+  const char *next_allowed; // the first place the next match can start.
+  long written;
+  Match spans[MAX_PAIRS];
+} Replacer;
+
+static void _emit(Replacer *rp, const char *data, long len) {
+  if (len > 0) {
+    rp->write(data, len, rp->ctx);
+    rp->written += len;
+  }
+}
+
+// read the number of a $N at *idx, moving past it.
+static int _group_number(const char *replacement, int *idx) {
+  int n = 0;
+  while (replacement[*idx] >= '0' && replacement[*idx] <= '9') {
+    n = n * 10 + (replacement[*idx] - '0');
+    (*idx)++;
+  }
+  return n;
+}
+
+// check every $N refers to a pair the pattern has, and note whether any of
+// them needs the spans of the pairs.
+static int _template_check(const char *replacement, const REComp *r,
+                           int *needs_spans) {
+  *needs_spans = 0;
+  for (int i = 0; replacement[i] != '\0';) {
+    if (replacement[i] != '$' || replacement[i + 1] < '0' ||
+        replacement[i + 1] > '9') {
+      i += (replacement[i] == '$' && replacement[i + 1] == '$') ? 2 : 1;
+      continue;
+    }
+    i++;
+    int n = _group_number(replacement, &i);
+    if (n > r->num_pairs) {
+      return 0;
+    }
+    if (n > 0) {
+      *needs_spans = 1;
+    }
+  }
+  return 1;
+}
+
+// write the template out for the match m in line, with the runs of plain text
+// between the $s written whole.
+static void _expand(Replacer *rp, const char *line, Match m) {
+  const char *replacement = rp->replacement;
+  int run = 0;
+  int i = 0;
+
+  while (replacement[i] != '\0') {
+    if (replacement[i] != '$') {
+      i++;
+      continue;
+    }
+    _emit(rp, &replacement[run], i - run);
+
+    if (replacement[i + 1] == '$') {
+      // $$ is a plain $.
+      _emit(rp, "$", 1);
+      i += 2;
+    } else if (replacement[i + 1] >= '0' && replacement[i + 1] <= '9') {
+      i++;
+      int n = _group_number(replacement, &i);
+      Match span = (n == 0) ? m : rp->spans[n - 1];
+      _emit(rp, line + span.start, span.end - span.start + 1);
+    } else {
+      // a $ that isn't a reference is just a $.
+      _emit(rp, "$", 1);
+      i++;
+    }
+    run = i;
+  }
+
+  _emit(rp, &replacement[run], i - run);
+}
+
+static int _replace_match(const LineMatch *lm, void *arg) {
+  Replacer *rp = arg;
+  const char *line = rp->buf + lm->line_offset;
+  const char *start = line + lm->match.start;
+  const char *end = line + lm->match.end + 1;
+
+  if (start < rp->next_allowed) {
+    return 0;
+  }
+
+  if (rp->needs_spans) {
+    _interp_spans(line, lm->line_len, rp->r, lm->match.start, rp->spans);
+  }
+
+  _emit(rp, rp->copied_to, start - rp->copied_to);
+  _expand(rp, line, lm->match);
+
+  rp->copied_to = end;
+  // an empty match still uses up its start, so the next one can't be there.
+  rp->next_allowed = (end > start) ? end : start + 1;
+  return 0;
+}
+
+long re_replace_stream(const char *input, long len, const REComp *compiled,
+                       REScratch *scratch, const char *replacement,
+                       re_write_fn write, void *ctx) {
+  Replacer rp = {
+      .r = compiled,
+      .replacement = replacement,
+      .write = write,
+      .ctx = ctx,
+      .buf = input,
+      .copied_to = input,
+      .next_allowed = input,
+  };
+  if (!_template_check(replacement, compiled, &rp.needs_spans)) {
+    return RE_BAD_TEMPLATE;
+  }
+
+  long result =
+      re_scan_lines(input, len, compiled, scratch, 0, _replace_match, &rp);
+  if (result == RE_BUDGET_EXCEEDED) {
+    return RE_BUDGET_EXCEEDED;
+  }
+
+  _emit(&rp, rp.copied_to, input + len - rp.copied_to);
+  return rp.written;
+}
+
+// fills the caller's buffer as far as it goes, and keeps counting past that.
+typedef struct OutBuf {
+  char *data;
+  long cap;
+  long len;
+} OutBuf;
+
+static void _out_write(const char *data, long len, void *arg) {
+  OutBuf *out = arg;
+  if (out->data && out->len < out->cap) {
+    long room = out->cap - out->len;
+    memcpy(out->data + out->len, data, len < room ? len : room);
+  }
+  out->len += len;
+}
+
+long re_replace(const char *input, long len, const REComp *compiled,
+                REScratch *scratch, const char *replacement, char *out_buf,
+                long out_cap) {
+  OutBuf out = {.data = out_buf, .cap = out_cap};
+  return re_replace_stream(input, len, compiled, scratch, replacement,
+                           _out_write, &out);
+}
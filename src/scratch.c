@@ -0,0 +1,111 @@
+#include "engine.h"
+#include "libregex.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+
+REScratch *re_scratch_alloc(const REComp *compiled) {
+  REScratch *scratch = calloc(1, sizeof(REScratch));
+  _scratch_reserve(scratch, compiled->n_states, 0);
+  return scratch;
+}
+
+void re_scratch_free(REScratch *scratch) {
+  if (!scratch) {
+    return;
+  }
+
+  free(scratch->groups);
+  free(scratch->positions);
+  free(scratch->matches);
+  free(scratch);
+}
+
+void _scratch_reserve(REScratch *scratch, int n_states, int line_len) {
+  if (n_states > scratch->state_cap) {
+    free(scratch->groups);
+    scratch->groups = malloc(sizeof(int) * 6 * n_states);
+    scratch->state_cap = n_states;
+
+    // the heads of both generations start out empty.
+    for (int s = 0; s < n_states; s++) {
+      scratch->groups[s] = -1;
+      scratch->groups[3 * n_states + s] = -1;
+    }
+  }
+
+  if (line_len > scratch->line_cap) {
+    // grow geometrically, so a file of slowly lengthening lines doesn't
+    // reallocate on every one.
+    int cap = scratch->line_cap ? scratch->line_cap : 64;
+    while (cap < line_len) {
+      cap *= 2;
+    }
+
+    free(scratch->positions);
+    scratch->positions = malloc(sizeof(int) * 2 * cap);
+    scratch->line_cap = cap;
+  }
+}
+
+void _scratch_reserve_matches(REScratch *scratch, int line_len) {
+  // a match can start at every byte, plus the empty match at the end.
+  int needed = line_len + 1;
+  if (needed > scratch->matches_cap) {
+    int cap = scratch->matches_cap ? scratch->matches_cap : 64;
+    while (cap < needed) {
+      cap *= 2;
+    }
+
+    free(scratch->matches);
+    scratch->matches = malloc(sizeof(Match) * cap);
+    scratch->matches_cap = cap;
+  }
+}
+
+void re_scratch_set_budget(REScratch *scratch, long max_steps,
+                           long long deadline_ns) {
+  scratch->max_steps = max_steps;
+  scratch->deadline_ns = deadline_ns;
+}
+
+void _budget_start(REScratch *scratch) {
+  scratch->steps_used = 0;
+
+  if (!scratch->max_steps && !scratch->deadline_ns) {
+    // nothing to enforce, so make sure the countdown never runs out.
+    scratch->budget_grant = LONG_MAX;
+  } else {
+    scratch->budget_grant = RE_BUDGET_INTERVAL;
+    if (scratch->max_steps && scratch->max_steps < RE_BUDGET_INTERVAL) {
+      scratch->budget_grant = scratch->max_steps;
+    }
+  }
+  scratch->budget_left = scratch->budget_grant;
+}
+
+int _budget_exhausted(REScratch *scratch) {
+  scratch->steps_used += scratch->budget_grant - scratch->budget_left;
+
+  if (scratch->max_steps && scratch->steps_used > scratch->max_steps) {
+    return 1;
+  }
+
+  if (scratch->deadline_ns) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((long long)now.tv_sec * 1000000000LL + now.tv_nsec >=
+        scratch->deadline_ns) {
+      return 1;
+    }
+  }
+
+  // still good, hand out the next stretch of steps.
+  long grant = RE_BUDGET_INTERVAL;
+  if (scratch->max_steps && scratch->max_steps - scratch->steps_used < grant) {
+    grant = scratch->max_steps - scratch->steps_used;
+  }
+  scratch->budget_grant = grant;
+  scratch->budget_left = grant;
+  return 0;
+}
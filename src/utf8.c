@@ -0,0 +1,343 @@
+#include "engine.h"
+#include "libregex.h"
+#include "macros.h"
+#include "utf8_letters.h"
+#include <stdlib.h>
+#include <string.h>
+
+// in RE_UTF8 mode, every object that can match a non-ascii code point is a
+// set of code points. at compile time the set gets split into byte-range
+// sequences, the same way re2 and rust's regex do it, so that matching never
+// has to decode anything: it just checks each byte against a range.
+
+#define MAX_CODE_POINT 0x10ffff
+
+// a growable list of inclusive [lo, hi] code point ranges.
+typedef struct CpRanges {
+  uint32_t *points;
+  int num_points;
+  int cap;
+} CpRanges;
+
+static void _ranges_push(CpRanges *r, uint32_t lo, uint32_t hi) {
+  if (r->num_points + 2 > r->cap) {
+    r->cap = r->cap ? r->cap * 2 : 16;
+    r->points = realloc(r->points, sizeof(uint32_t) * r->cap);
+  }
+  r->points[r->num_points++] = lo;
+  r->points[r->num_points++] = hi;
+}
+
+static int _range_cmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// sort the ranges and merge the ones that touch.
+static void _ranges_normalize(CpRanges *r) {
+  qsort(r->points, r->num_points / 2, sizeof(uint32_t) * 2, _range_cmp);
+
+  int out = 0;
+  for (int i = 0; i < r->num_points; i += 2) {
+    uint32_t lo = r->points[i];
+    uint32_t hi = r->points[i + 1];
+    if (out > 0 && lo <= r->points[out - 1] + 1) {
+      r->points[out - 1] = MAX(r->points[out - 1], hi);
+    } else {
+      r->points[out++] = lo;
+      r->points[out++] = hi;
+    }
+  }
+  r->num_points = out;
+}
+
+// everything from 1 to MAX_CODE_POINT that isn't in the ranges. NULL never
+// matches anything, same as in byte mode.
+static void _ranges_complement(CpRanges *r) {
+  _ranges_normalize(r);
+
+  CpRanges out = {0};
+  uint32_t next = 1;
+  for (int i = 0; i < r->num_points; i += 2) {
+    if (r->points[i] > next) {
+      _ranges_push(&out, next, r->points[i] - 1);
+    }
+    next = MAX(next, r->points[i + 1] + 1);
+  }
+  if (next <= MAX_CODE_POINT) {
+    _ranges_push(&out, next, MAX_CODE_POINT);
+  }
+
+  free(r->points);
+  *r = out;
+}
+
+static int _utf8_len(uint32_t cp) {
+  return (cp < 0x80) ? 1 : (cp < 0x800) ? 2 : (cp < 0x10000) ? 3 : 4;
+}
+
+static void _utf8_encode(uint32_t cp, unsigned char *out) {
+  switch (_utf8_len(cp)) {
+  case 1: {
+    out[0] = cp;
+  } break;
+  case 2: {
+    out[0] = 0xc0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3f);
+  } break;
+  case 3: {
+    out[0] = 0xe0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3f);
+    out[2] = 0x80 | (cp & 0x3f);
+  } break;
+  default: {
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3f);
+    out[2] = 0x80 | ((cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+  } break;
+  }
+}
+
+static void _class_push(Utf8Class *c, const Utf8Seq *seq) {
+  c->seqs = realloc(c->seqs, sizeof(Utf8Seq) * (c->num_seqs + 1));
+  c->seqs[c->num_seqs++] = *seq;
+}
+
+// split [lo, hi] until every piece encodes to the same length, and every
+// continuation byte below the first one that differs covers its whole range.
+// each piece is then exactly a product of byte ranges.
+static void _split_range(Utf8Class *c, uint32_t lo, uint32_t hi) {
+  if (lo > hi) {
+    return;
+  }
+
+  // surrogates can't be encoded.
+  if (lo <= 0xdfff && hi >= 0xd800) {
+    if (lo < 0xd800) {
+      _split_range(c, lo, 0xd7ff);
+    }
+    if (hi > 0xdfff) {
+      _split_range(c, 0xe000, hi);
+    }
+    return;
+  }
+
+  static const uint32_t max_of_len[] = {0x7f, 0x7ff, 0xffff};
+  for (int i = 0; i < 3; i++) {
+    if (lo <= max_of_len[i] && hi > max_of_len[i]) {
+      _split_range(c, lo, max_of_len[i]);
+      _split_range(c, max_of_len[i] + 1, hi);
+      return;
+    }
+  }
+
+  int len = _utf8_len(lo);
+  for (int i = 1; i < len; i++) {
+    uint32_t m = ((uint32_t)1 << (6 * i)) - 1;
+    if ((lo & ~m) != (hi & ~m)) {
+      if ((lo & m) != 0) {
+        _split_range(c, lo, lo | m);
+        _split_range(c, (lo | m) + 1, hi);
+        return;
+      }
+      if ((hi & m) != m) {
+        _split_range(c, lo, (hi & ~m) - 1);
+        _split_range(c, hi & ~m, hi);
+        return;
+      }
+    }
+  }
+
+  Utf8Seq seq = {.len = len};
+  _utf8_encode(lo, seq.lo);
+  _utf8_encode(hi, seq.hi);
+  _class_push(c, &seq);
+}
+
+// the sequences come out of _split_range in code point order, so the ones
+// whose lead byte range takes in a given byte are all next to each other.
+static void _lead_index(Utf8Class *c) {
+  c->lead_index = calloc(2 * 256, sizeof(int));
+  for (int i = 0; i < c->num_seqs; i++) {
+    for (int b = c->seqs[i].lo[0]; b <= c->seqs[i].hi[0]; b++) {
+      if (c->lead_index[2 * b] == c->lead_index[2 * b + 1]) {
+        c->lead_index[2 * b] = i;
+      }
+      c->lead_index[2 * b + 1] = i + 1;
+    }
+  }
+}
+
+static Utf8Class _class_from_ranges(CpRanges *r) {
+  _ranges_normalize(r);
+
+  Utf8Class c = {0};
+  for (int i = 0; i < r->num_points; i += 2) {
+    _split_range(&c, r->points[i], r->points[i + 1]);
+  }
+  _lead_index(&c);
+
+  free(r->points);
+  return c;
+}
+
+int _utf8_decode(const char *s, uint32_t *cp) {
+  const unsigned char *u = (const unsigned char *)s;
+
+  int len = 1;
+  if (u[0] >= 0xf0) {
+    len = 4;
+  } else if (u[0] >= 0xe0) {
+    len = 3;
+  } else if (u[0] >= 0xc0) {
+    len = 2;
+  }
+
+  if (len == 1) {
+    *cp = u[0];
+    return 1;
+  }
+
+  uint32_t value = u[0] & (0x3f >> (len - 1));
+  for (int i = 1; i < len; i++) {
+    if ((u[i] & 0xc0) != 0x80) {
+      // a broken sequence in the pattern, just take the byte as it is.
+      *cp = u[0];
+      return 1;
+    }
+    value = (value << 6) | (u[i] & 0x3f);
+  }
+
+  *cp = value;
+  return len;
+}
+
+// parse the {name} of a \p{name} at *idx, adding its ranges.
+static int _parse_property(const char *pattern, int *idx, CpRanges *r) {
+  if (pattern[*idx] != '{') {
+    return 0;
+  }
+
+  const char *name = &pattern[*idx + 1];
+  const char *close = strchr(name, '}');
+  if (close == NULL) {
+    return 0;
+  }
+  *idx = close - pattern + 1;
+
+  if (close - name == 1 && name[0] == 'L') {
+    int n = sizeof(letter_ranges) / sizeof(letter_ranges[0]);
+    for (int i = 0; i < n; i += 2) {
+      _ranges_push(r, letter_ranges[i], letter_ranges[i + 1]);
+    }
+  } else {
+    ERROR("unknown unicode property '%.*s'.", (int)(close - name), name);
+    return 0;
+  }
+
+  return 1;
+}
+
+Utf8Class _utf8_property(const char *pattern, int *idx) {
+  CpRanges r = {0};
+  _parse_property(pattern, idx, &r);
+  return _class_from_ranges(&r);
+}
+
+Utf8Class _utf8_code_point(const char *pattern, int *idx) {
+  uint32_t cp;
+  *idx += _utf8_decode(&pattern[*idx], &cp);
+
+  CpRanges r = {0};
+  _ranges_push(&r, cp, cp);
+  return _class_from_ranges(&r);
+}
+
+Utf8Class _utf8_dot(void) {
+  // everything except for a newline.
+  CpRanges r = {0};
+  _ranges_push(&r, 1, '\n' - 1);
+  _ranges_push(&r, '\n' + 1, MAX_CODE_POINT);
+  return _class_from_ranges(&r);
+}
+
+Utf8Class _utf8_class(const char *pattern, int *idx) {
+  CpRanges r = {0};
+  int is_complement = 0;
+
+  if (pattern[*idx] == '^') {
+    is_complement = 1;
+    (*idx)++;
+  }
+
+  while (pattern[*idx] != ']' && pattern[*idx] != '\0') {
+    if (pattern[*idx] == '\\' && pattern[*idx + 1] == 'p') {
+      *idx += 2;
+      if (!_parse_property(pattern, idx, &r)) {
+        break;
+      }
+      continue;
+    }
+
+    uint32_t start, end;
+    *idx += _utf8_decode(&pattern[*idx], &start);
+    end = start;
+
+    if (pattern[*idx] == '-' && pattern[*idx + 1] != ']' &&
+        pattern[*idx + 1] != '\0') {
+      (*idx)++;
+      *idx += _utf8_decode(&pattern[*idx], &end);
+    }
+
+    if (start <= end) {
+      _ranges_push(&r, start, end);
+    }
+  }
+
+  if (pattern[*idx] == ']') {
+    (*idx)++;
+  }
+
+  if (is_complement) {
+    _ranges_complement(&r);
+  }
+
+  return _class_from_ranges(&r);
+}
+
+int _utf8_eat_len(const Utf8Class *c, const char *line, const char *end) {
+  const unsigned char *u = (const unsigned char *)line;
+  int lo = c->lead_index[2 * u[0]];
+  int hi = c->lead_index[2 * u[0] + 1];
+  if (lo == hi) {
+    return 0;
+  }
+
+  // the lead byte fixes how long the code point is.
+  int len = c->seqs[lo].len;
+  if (len > end - line) {
+    return 0;
+  }
+
+  // each sequence spells one run of code points, and utf-8 sorts the same as
+  // the code points do. so the only sequence that can hold these bytes is the
+  // last one that starts at or before them.
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (memcmp(c->seqs[mid].lo, u, len) <= 0) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  const Utf8Seq *seq = &c->seqs[lo];
+  for (int j = 0; j < len; j++) {
+    if (u[j] < seq->lo[j] || u[j] > seq->hi[j]) {
+      return 0;
+    }
+  }
+  return len;
+}
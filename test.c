@@ -3,6 +3,14 @@
 #include <stdio.h>
 #include <string.h>
 
+static int print_line_match(const LineMatch *lm, void *ctx) {
+  const char *buf = ctx;
+  printf("  line %ld (offset %ld): '%.*s' (%d - %d)\n", lm->line_no,
+         lm->line_offset, lm->line_len, buf + lm->line_offset, lm->match.start,
+         lm->match.end);
+  return 0;
+}
+
 void match(char **lines, int n_lines, char *pattern) {
   printf("\n" ANSI_BG_GREEN ANSI_BLACK "\t Matching against '%s' " ANSI_RESET
          "\n\n",
@@ -42,6 +50,31 @@ void match(char **lines, int n_lines, char *pattern) {
 #undef PRINT_LINE
 }
 
+void extract(char **lines, int n_lines, char *pattern) {
+  printf("\n" ANSI_BG_GREEN ANSI_BLACK "\t Extracting with '%s' " ANSI_RESET
+         "\n\n",
+         pattern);
+
+  REComp *r = re_compile(pattern);
+  printf("Plan: %s\n", re_plan_name(re_get_plan(r)));
+
+  for (int i = 0; i < n_lines; i++) {
+    Match spans[MAX_PAIRS] = {0};
+    if (re_extract(lines[i], r, spans)) {
+      printf(ANSI_GREEN "%2d: %s" ANSI_RESET "\n", i + 1, lines[i]);
+      for (int j = 0; j < r->num_pairs; j++) {
+        printf("\t\tpair %d: (%d - %d) '%.*s'\n", j, spans[j].start,
+               spans[j].end, spans[j].end - spans[j].start + 1,
+               lines[i] + spans[j].start);
+      }
+    } else {
+      printf(ANSI_RED "%2d: %s" ANSI_RESET "\n", i + 1, lines[i]);
+    }
+  }
+
+  re_free(r);
+}
+
 int main(int argc, char *argv[]) {
 
 #define TESTCOMP(strlit)                                                       \
@@ -97,5 +130,141 @@ int main(int argc, char *argv[]) {
 
   match((char *[]){"a))", ")a", "a()a", "aaa"}, 4, "\\)");
 
+  // fixed-width classes run bit-parallel, check the plan in the debug print.
+  match((char *[]){"gray", "grey", "groy", "a grey gray"}, 4, "gr[ae]y");
+
+  // anchored record parsing runs one-pass, and reports where each pair went.
+  extract((char *[]){"200 GET /index.html", "404 POST /a/b", "GET /", "1 A"}, 4,
+          "^[0-9]+ [A-Z]+ [^ ]*$");
+
+  { // utf-8 mode matches whole code points, and classes can be non-ascii.
+    char *lines[] = {"αβγ abc ωx", "héllo wörld", "日本語"};
+    char *patterns[] = {"[α-ω]+", "\\p{L}+", "^.{3}$"};
+    for (int i = 0; i < 3; i++) {
+      REComp *r = re_compile_flags(patterns[i], RE_UTF8);
+      Match matches[32];
+      int num_matches = re_get_matches(lines[i], r, matches);
+      printf("\n'%s' on '%s' (%s):", patterns[i], lines[i],
+             re_plan_name(re_get_plan(r)));
+      for (int j = 0; j < num_matches; j++) {
+        printf(" (%d - %d)", matches[j].start, matches[j].end);
+      }
+      printf("\n");
+      re_free(r);
+    }
+  }
+
+  { // a step budget cuts a long scan short instead of finishing it.
+    REComp *r = re_compile("a*b");
+    REScratch *scratch = re_scratch_alloc(r);
+    char line[4096];
+    memset(line, 'a', sizeof(line));
+    Match matches[sizeof(line)];
+
+    re_scratch_set_budget(scratch, 1000, 0);
+    printf("\nbudget of 1000 steps: %d\n",
+           re_get_matches_scratch(line, sizeof(line), r, scratch, matches));
+    re_scratch_set_budget(scratch, 0, 0);
+    printf("no budget: %d\n",
+           re_get_matches_scratch(line, sizeof(line), r, scratch, matches));
+
+    re_scratch_free(scratch);
+    re_free(r);
+  }
+
+  { // a whole buffer at once, with ^ and $ anchored to each line.
+    const char *buf = "alpha 12\nbeta\n\ngamma 345\n7 delta";
+    const char *patterns[] = {"[0-9]+$", "^[a-z]+"};
+    for (int i = 0; i < 2; i++) {
+      REComp *r = re_compile(patterns[i]);
+      REScratch *scratch = re_scratch_alloc(r);
+      printf("\nscanning lines for '%s':\n", patterns[i]);
+      long n = re_scan_lines(buf, strlen(buf), r, scratch, RE_SCAN_ONE_PER_LINE,
+                             print_line_match, (void *)buf);
+      printf("  %ld matches\n", n);
+      re_scratch_free(scratch);
+      re_free(r);
+    }
+  }
+
+  { // a column of rows, with a bit per row for whether it matched.
+    const char *data = "2024-01-05nope1999-12-31x2000-02-29";
+    int32_t offsets[] = {0, 10, 14, 24, 25, 35};
+    REComp *r = re_compile("^[0-9]{4}-[0-9]{2}-[0-9]{2}$");
+    REScratch *scratch = re_scratch_alloc(r);
+    uint64_t bitmap[1];
+    long n = re_match_batch(data, offsets, 5, r, scratch, bitmap);
+    printf("\nbatch: %ld of 5 rows matched, bitmap %llx\n", n,
+           (unsigned long long)bitmap[0]);
+    re_scratch_free(scratch);
+    re_free(r);
+  }
+
+  { // search and replace, sized first and then written in one go.
+    const char *input = "user=alice id=4411\nuser=bob id=92\n";
+    REComp *r = re_compile("id=[0-9]+");
+    REScratch *scratch = re_scratch_alloc(r);
+    long len = re_replace(input, strlen(input), r, scratch, "id=<redacted>",
+                          NULL, 0);
+    char out[128];
+    re_replace(input, strlen(input), r, scratch, "id=<redacted>", out,
+               sizeof(out));
+    printf("\nreplaced (%ld bytes):\n%.*s", len, (int)len, out);
+    re_scratch_free(scratch);
+    re_free(r);
+
+    r = re_compile("^[a-z]+=[a-z]+ ");
+    scratch = re_scratch_alloc(r);
+    len = re_replace(input, strlen(input), r, scratch, "$3: ", out,
+                     sizeof(out));
+    printf("with a $N:\n%.*s", (int)len, out);
+    re_scratch_free(scratch);
+    re_free(r);
+  }
+
+  { // a lexer, with the longest match winning and then the earliest rule.
+    LexRule rules[] = {
+        {"if", 1}, {"[a-z][a-z0-9]*", 2}, {"[0-9]+", 3}, {"[=<>]=?", 4},
+        {" +", 5},
+    };
+    const char *input = "if x1 >= 42 then?";
+    RELexer *lexer = re_lexer_compile(rules, 5);
+    // a few tokens at a time, picking up after the last one each time.
+    Token tokens[4];
+    long from = 0;
+    long n;
+    printf("\ntokens:");
+    do {
+      n = re_lex(lexer, input, strlen(input), from, tokens, 4);
+      for (long i = 0; i < n; i++) {
+        Token t = tokens[i];
+        printf(" %d:'%.*s'", t.id, (int)(t.end - t.start + 1),
+               input + t.start);
+      }
+      from = n ? tokens[n - 1].end + 1 : from;
+    } while (n == 4);
+    printf("\n");
+    re_lexer_free(lexer);
+  }
+
+  { // a document that keeps its matches up to date through edits.
+    const char *text = "let x = 10; let y = 20;";
+    REComp *r = re_compile("[0-9]+");
+    REDoc *doc = re_doc_new(r, text, strlen(text));
+    REDelta delta;
+    re_doc_edit(doc, 9, 0, "5", 1, &delta);
+    printf("\nafter an edit: %ld removed, %ld added", delta.num_removed,
+           delta.num_added);
+    for (long i = 0; i < delta.num_added; i++) {
+      printf(" (%d - %d)", delta.added[i].start, delta.added[i].end);
+    }
+    long n;
+    const Match *matches = re_doc_matches(doc, &n);
+    printf(", %ld matches, the last at (%d - %d)\n", n, matches[n - 1].start,
+           matches[n - 1].end);
+    re_doc_free(doc);
+    re_free(r);
+  }
+
   return 0;
 }
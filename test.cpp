@@ -0,0 +1,106 @@
+#include "libregex.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// every pattern gets matched both ways over the same lines, and the matches
+// have to be identical.
+static const char *lines[] = {
+    "",           "a",          "aa",         "aaab",       "hello",
+    "wwhello",    "hellowww",   "gray grey",  "a))",        "2024-01-05",
+    "x1 >= 42",   "ab\ncd",     "-[]^\\$",    "a{b}c,d",    "\"hi there\"",
+    "200 GET /x", "aXbYc zzz.", "$$$",        "a{2}",       "zzzzzzzzzz",
+};
+static const int n_lines = sizeof(lines) / sizeof(lines[0]);
+
+// plus one long line, where running each start on its own would show.
+static std::string long_line;
+
+template <re::Pattern P> static bool same(const REComp *r, const char *line) {
+  int len = strlen(line);
+  std::vector<Match> want(len + 1);
+  std::vector<Match> got(len + 1);
+  int n_want = re_get_matches(line, r, want.data());
+  int n_got = re::Regex<P>::get_matches(line, got.data());
+
+  if (n_want != n_got ||
+      re::Regex<P>::is_match(line) != (n_want > 0)) {
+    return false;
+  }
+  for (int j = 0; j < n_want; j++) {
+    if (want[j].start != got[j].start || want[j].end != got[j].end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <re::Pattern P> static int check() {
+  REComp *r = re_compile(P.chars);
+  int mismatched = 0;
+
+  for (int i = 0; i < n_lines; i++) {
+    if (!same<P>(r, lines[i])) {
+      printf("  '%s' differs on '%s'\n", P.chars, lines[i]);
+      mismatched++;
+    }
+  }
+  if (!same<P>(r, long_line.c_str())) {
+    printf("  '%s' differs on the long line\n", P.chars);
+    mismatched++;
+  }
+
+  printf("'%s' (%d states, %d byte classes): %s\n", P.chars,
+         re::Regex<P>::n_states, re::Regex<P>::n_classes,
+         mismatched ? "differs" : "same");
+  re_free(r);
+  return mismatched;
+}
+
+int main() {
+  int mismatched = 0;
+
+  while (long_line.size() < 100000) {
+    long_line += "gray x1 >= 42 aaab hello \"hi\" 2024-01-05 zzzz ";
+  }
+
+  mismatched += check<"hello">();
+  mismatched += check<"^hello$">();
+  mismatched += check<"a*">();
+  mismatched += check<"a+">();
+  mismatched += check<"a?">();
+  mismatched += check<"^a*$">();
+  mismatched += check<"a{2,3}">();
+  mismatched += check<"a{2,}">();
+  mismatched += check<"a{2}">();
+  mismatched += check<"gr[ae]y">();
+  mismatched += check<"[^a-d]">();
+  mismatched += check<"\\)">();
+  mismatched += check<"\\$$">();
+  mismatched += check<".*">();
+  mismatched += check<"\"[a-z - ]*\"">();
+  mismatched += check<"^[0-9]{4}-[0-9]{2}-[0-9]{2}$">();
+  mismatched += check<"^[0-9]+ [A-Z]+ [^ ]*$">();
+  mismatched += check<"[0-9]{4}-[0-9]{2}-[0-9]{2}">();
+  mismatched += check<"[a-z][a-z0-9]*">();
+  mismatched += check<"[a-z]+">();
+  mismatched += check<"[a-z]+x">();
+  mismatched += check<"[=<>]=?">();
+  mismatched += check<"[-a]">();
+  mismatched += check<"[a-]+">();
+  mismatched += check<"[^]">();
+  mismatched += check<"[]">();
+  mismatched += check<"a(bc]d">();
+  mismatched += check<"a{b}">();
+  mismatched += check<"z{12}">();
+  mismatched += check<"[a-z]*[A-Z]">();
+  mismatched += check<"a*a">();
+  mismatched += check<"">();
+  mismatched += check<"^">();
+  mismatched += check<"$">();
+  mismatched += check<"^$">();
+
+  printf("\n%s\n", mismatched ? "the c++ matches differ" : "all the same");
+  return mismatched != 0;
+}